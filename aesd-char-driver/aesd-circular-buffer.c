@@ -12,35 +12,67 @@
 
 #ifdef __KERNEL__
 #include <linux/string.h>
-#include <linux/slab.h>
-#define FREE(pointer) kfree(pointer)
 #else
 #include <string.h>
-#define FREE(pointer)
 #endif
 
 void aesd_circular_buffer_clear(AesdCircularBuffer *buffer)
 {
-    buffer->full = 0;
-    buffer->in_offs = 0;
-    buffer->out_offs = 0;
-    for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; ++i)
+    aesd_buffer_ring_init(buffer);
+}
+
+size_t aesd_circular_buffer_size(AesdCircularBuffer *buffer)
+{
+    size_t count = aesd_buffer_ring_count(buffer);
+    AesdBufferEntry *newest;
+    if (count == 0)
     {
-        FREE(buffer->entry[i].buffptr);
-        buffer->entry[i].buffptr = NULL;
-        buffer->entry[i].size = 0;
+        return 0;
     }
+
+    newest = aesd_buffer_ring_get(buffer, count - 1);
+    return newest->offset + newest->size - aesd_buffer_ring_get(buffer, 0)->offset;
 }
 
-size_t aesd_circular_buffer_size(AesdCircularBuffer *buffer)
+/**
+ * Binary searches the entry offsets of @param buffer for @param char_offset.
+ * @return the index, counted from the oldest entry, of the last entry starting at or before
+ *      char_offset.  The caller must check char_offset is not past the end of that entry.
+ */
+static size_t aesd_circular_buffer_search(AesdCircularBuffer *buffer, size_t char_offset)
 {
-    size_t size = 0;
-    for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; ++i)
+    size_t low = 0;
+    size_t high = aesd_buffer_ring_count(buffer);
+    size_t base;
+    size_t middle;
+    if (high == 0)
+    {
+        return 0;
+    }
+
+    base = aesd_buffer_ring_get(buffer, 0)->offset;
+    while (high - low > 1)
     {
-        size += buffer->entry[i].size;
+        middle = low + (high - low) / 2;
+        if (aesd_buffer_ring_get(buffer, middle)->offset - base <= char_offset)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
     }
 
-    return size;
+    return low;
+}
+
+/**
+ * @return the number of entries currently stored in @param buffer
+ */
+size_t aesd_circular_buffer_entry_count(AesdCircularBuffer *buffer)
+{
+    return aesd_buffer_ring_count(buffer);
 }
 
 AesdBufferEntry *aesd_circular_buffer_next_entry(AesdCircularBuffer *buffer, AesdBufferEntry *entry)
@@ -90,36 +122,62 @@ size_t aesd_circular_buffer_index_of(AesdCircularBuffer *buffer, AesdBufferEntry
 AesdBufferEntry *aesd_circular_buffer_find_entry_offset_for_fpos(AesdCircularBuffer *buffer,
                                                                  size_t char_offset, size_t *entry_offset_byte_rtn)
 {
-    AesdBufferEntry *entry;
-    if (buffer->out_offs == buffer->in_offs && !buffer->full)
+    AesdBufferEntry *entry = aesd_buffer_ring_get(buffer, aesd_circular_buffer_search(buffer, char_offset));
+    size_t entry_start;
+    if (entry == NULL)
     {
         *entry_offset_byte_rtn = char_offset;
         return NULL;
     }
 
-    entry = &buffer->entry[buffer->out_offs];
-
-    if (char_offset < entry->size)
+    entry_start = entry->offset - aesd_buffer_ring_get(buffer, 0)->offset;
+    if (char_offset - entry_start >= entry->size)
     {
-        *entry_offset_byte_rtn = char_offset;
-        return entry;
+        *entry_offset_byte_rtn = char_offset - entry_start - entry->size;
+        return NULL;
     }
 
-    char_offset -= entry->size;
-    *entry_offset_byte_rtn = char_offset;
-    for (uint8_t i = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i != buffer->in_offs; i = (i + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+    *entry_offset_byte_rtn = char_offset - entry_start;
+    return entry;
+}
+
+/**
+ * Describes the bytes [@param char_offset, char_offset + @param length) of @param buffer, as if all
+ * entries were concatenated end to end, without copying them.
+ * Any necessary locking must be performed by the caller, and the vectors are only valid until the
+ * described entries are evicted.
+ * @param vecs is filled with one vector per entry touched, the first starting part way into its
+ *      entry and the last trimmed to the end of the range
+ * @param vecs_len is the number of vectors available in vecs, the range is cut short when it runs out
+ * @param bytes_rtn if not NULL is set to the total number of bytes described
+ * @return the number of vectors filled, 0 if char_offset is not in the buffer
+ */
+size_t aesd_circular_buffer_export_range(AesdCircularBuffer *buffer, size_t char_offset, size_t length,
+                                         AesdBufferVec *vecs, size_t vecs_len, size_t *bytes_rtn)
+{
+    size_t entry_offset = 0;
+    size_t bytes = 0;
+    size_t vec_count = 0;
+    size_t n = aesd_circular_buffer_search(buffer, char_offset);
+    AesdBufferEntry *entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, char_offset, &entry_offset);
+
+    while (entry != NULL && bytes < length && vec_count < vecs_len)
     {
-        entry = &buffer->entry[i];
-        if (char_offset < entry->size)
-        {
-            return entry;
-        }
+        vecs[vec_count].iov_base = (void *)(entry->buffptr + entry_offset);
+        vecs[vec_count].iov_len = (entry->size - entry_offset < length - bytes) ? entry->size - entry_offset : length - bytes;
+        bytes += vecs[vec_count].iov_len;
+        ++vec_count;
 
-        char_offset -= entry->size;
-        *entry_offset_byte_rtn = char_offset;
+        entry_offset = 0;
+        entry = aesd_buffer_ring_get(buffer, ++n);
     }
 
-    return NULL;
+    if (bytes_rtn != NULL)
+    {
+        *bytes_rtn = bytes;
+    }
+
+    return vec_count;
 }
 
 /**
@@ -132,18 +190,41 @@ AesdBufferEntry *aesd_circular_buffer_find_entry_offset_for_fpos(AesdCircularBuf
  */
 const char *aesd_circular_buffer_add_entry(AesdCircularBuffer *buffer, AesdBufferEntry *entry)
 {
-    const char *entry_buffer = buffer->entry[buffer->in_offs].buffptr;
-    buffer->entry[buffer->in_offs].buffptr = entry->buffptr;
-    buffer->entry[buffer->in_offs].size = entry->size;
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    if (buffer->full)
+    AesdBufferEntry evicted;
+    if (aesd_circular_buffer_push(buffer, entry, &evicted))
     {
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        return entry_buffer;
+        return evicted.buffptr;
     }
-    else if (buffer->in_offs == buffer->out_offs)
+
+    return NULL;
+}
+
+/**
+ * Same as aesd_circular_buffer_add_entry, but copies the whole evicted entry to @param evicted.
+ * @return true if an entry was evicted
+ */
+bool aesd_circular_buffer_push(AesdCircularBuffer *buffer, AesdBufferEntry *entry, AesdBufferEntry *evicted)
+{
+    size_t count = aesd_buffer_ring_count(buffer);
+    AesdBufferEntry *newest = (count == 0) ? NULL : aesd_buffer_ring_get(buffer, count - 1);
+    AesdBufferEntry added = *entry;
+
+    added.offset = (newest == NULL) ? 0 : newest->offset + newest->size;
+
+    return aesd_buffer_ring_push(buffer, &added, evicted);
+}
+
+/**
+ * Removes the oldest entry from @param buffer and advances buffer->out_offs past it.
+ * Any necessary locking must be handled by the caller
+ * @return the buffptr of the removed entry, which the caller must free, or NULL if the buffer is empty
+ */
+const char *aesd_circular_buffer_remove_oldest(AesdCircularBuffer *buffer)
+{
+    AesdBufferEntry removed;
+    if (aesd_buffer_ring_pop(buffer, &removed))
     {
-        buffer->full = true;
+        return removed.buffptr;
     }
 
     return NULL;
@@ -154,5 +235,5 @@ const char *aesd_circular_buffer_add_entry(AesdCircularBuffer *buffer, AesdBuffe
  */
 void aesd_circular_buffer_init(AesdCircularBuffer *buffer)
 {
-    memset(buffer, 0, sizeof(AesdCircularBuffer));
+    aesd_buffer_ring_init(buffer);
 }
@@ -10,13 +10,24 @@
 
 #ifdef __KERNEL__
 #include <linux/types.h>
+#include <linux/uio.h>
+typedef struct kvec AesdBufferVec;
 #else
 #include <stddef.h> // size_t
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
+#include <sys/uio.h>
+typedef struct iovec AesdBufferVec;
 #endif
 
+#include "aesd-ring-buffer.h"
+
+/**
+ * Overridable so benchmarks can be built at other capacities, at most 255 for the uint8_t indices
+ */
+#ifndef AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+#endif
 
 typedef struct aesd_buffer_entry
 {
@@ -28,33 +39,35 @@ typedef struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
-} AesdBufferEntry;
-
-typedef struct aesd_circular_buffer
-{
-    /**
-     * An array of pointers to memory allocated for the most recent write operations
-     */
-    AesdBufferEntry entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
-    /**
-     * The current location in the entry structure where the next write should
-     * be stored.
-     */
-    uint8_t in_offs;
-    /**
-     * The first location in the entry structure to read from
-     */
-    uint8_t out_offs;
     /**
-     * set to true when the buffer entry structure is full
+     * Set when the entry is added to a buffer: the number of bytes added before it, so the
+     * distance between two entries' offsets is the number of bytes between them
      */
-    bool full;
-} AesdCircularBuffer;
+    size_t offset;
+} AesdBufferEntry;
+
+/**
+ * The most recent write operations, oldest first from out_offs.  See AESD_RING_HEAD for the
+ * meaning of entry, in_offs, out_offs and full.
+ */
+typedef AESD_RING_HEAD(aesd_circular_buffer, AesdBufferEntry, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, uint8_t) AesdCircularBuffer;
+
+/**
+ * Inline ring operations on AesdCircularBuffer, prefixed aesd_buffer_ring_.  Evicted entries are
+ * handed back to the caller, which owns their buffptr.
+ */
+AESD_RING_GENERATE(aesd_buffer_ring, aesd_circular_buffer, AesdBufferEntry, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, AESD_RING_NO_FREE)
 
+/**
+ * Empties @param buffer without freeing the entries, whose buffptr the caller owns and must
+ * release first, with whatever allocator it used
+ */
 extern void aesd_circular_buffer_clear(AesdCircularBuffer *buffer);
 
 extern size_t aesd_circular_buffer_size(AesdCircularBuffer *buffer);
 
+extern size_t aesd_circular_buffer_entry_count(AesdCircularBuffer *buffer);
+
 extern AesdBufferEntry *aesd_circular_buffer_next_entry(AesdCircularBuffer *buffer, AesdBufferEntry *entry);
 
 extern size_t aesd_circular_buffer_index_of(AesdCircularBuffer *buffer, AesdBufferEntry *entry);
@@ -64,6 +77,13 @@ extern AesdBufferEntry *aesd_circular_buffer_find_entry_offset_for_fpos(AesdCirc
 
 extern const char *aesd_circular_buffer_add_entry(AesdCircularBuffer *buffer, AesdBufferEntry *entry);
 
+extern bool aesd_circular_buffer_push(AesdCircularBuffer *buffer, AesdBufferEntry *entry, AesdBufferEntry *evicted);
+
+extern size_t aesd_circular_buffer_export_range(AesdCircularBuffer *buffer, size_t char_offset, size_t length,
+                                                AesdBufferVec *vecs, size_t vecs_len, size_t *bytes_rtn);
+
+extern const char *aesd_circular_buffer_remove_oldest(AesdCircularBuffer *buffer);
+
 extern void aesd_circular_buffer_init(AesdCircularBuffer *buffer);
 
 /**
@@ -0,0 +1,32 @@
+/*
+ * aesd-entry-queue.h
+ *
+ *  @brief Lock-free queues of circular buffer entries for user space threads
+ *
+ *  Kept apart from aesd-circular-buffer.h, which the driver, the tests and aesdsocket include,
+ *  so only users of the queues pull in the lock-free rings and their atomics.
+ */
+
+#ifndef AESD_ENTRY_QUEUE_H
+#define AESD_ENTRY_QUEUE_H
+
+#include "aesd-circular-buffer.h"
+#include "aesd-lockfree-ring.h"
+
+/**
+ * Capacity of the lock-free entry queues, which hand entries between user space threads rather
+ * than keep a history, so they never evict
+ */
+#define AESD_ENTRY_QUEUE_CAPACITY 1024
+
+/**
+ * Lock-free queues of AesdBufferEntry with one consumer and one or many producers, prefixed
+ * aesd_entry_spsc_ and aesd_entry_mpsc_.  See aesd-lockfree-ring.h for the operations.
+ */
+typedef AESD_SPSC_RING_HEAD(aesd_entry_spsc_queue, AesdBufferEntry, AESD_ENTRY_QUEUE_CAPACITY) AesdEntrySpscQueue;
+AESD_SPSC_RING_GENERATE(aesd_entry_spsc, aesd_entry_spsc_queue, AesdBufferEntry, AESD_ENTRY_QUEUE_CAPACITY)
+
+typedef AESD_MPSC_RING_HEAD(aesd_entry_mpsc_queue, AesdBufferEntry, AESD_ENTRY_QUEUE_CAPACITY) AesdEntryMpscQueue;
+AESD_MPSC_RING_GENERATE(aesd_entry_mpsc, aesd_entry_mpsc_queue, AesdBufferEntry, AESD_ENTRY_QUEUE_CAPACITY)
+
+#endif /* AESD_ENTRY_QUEUE_H */
@@ -0,0 +1,247 @@
+/*
+ * aesd-lockfree-ring.h
+ *
+ *  @brief Macro generated lock-free ring buffers for handing elements between user space threads
+ *
+ *  The lock-free counterpart of aesd-ring-buffer.h, in single producer (SPSC) and multiple
+ *  producer (MPSC) flavors, both with a single consumer.  in_offs and out_offs count every
+ *  element ever pushed and popped instead of wrapping, so the ring is full when they are
+ *  capacity apart, and each sits on its own cache line so producers and the consumer only
+ *  share a line when one of them has to look at the other's progress.  Unlike aesd-ring-buffer.h
+ *  a full ring never evicts: enqueue fails and the producer decides whether to retry.
+ *
+ *  The capacity must be a power of two.  Elements are copied in and out, so type must be
+ *  trivially copyable.
+ *
+ *  Example usage:
+ *  typedef AESD_SPSC_RING_HEAD(int_queue, int, 1024) IntQueue;
+ *  AESD_SPSC_RING_GENERATE(int_queue, int_queue, int, 1024)
+ *
+ *  IntQueue queue;
+ *  int_queue_init(&queue);
+ *  int_queue_enqueue(&queue, &value);
+ */
+
+#ifndef AESD_LOCKFREE_RING_H
+#define AESD_LOCKFREE_RING_H
+
+#ifdef __KERNEL__
+#error "aesd-lockfree-ring.h is only for user space, the kernel has its own lock-free primitives"
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define AESD_CACHE_LINE_SIZE 64
+
+#define AESD_LOCKFREE_RING_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/**
+ * Declares struct @param name holding up to @param capacity elements of @param type for one
+ * producer and one consumer.
+ *  in_offs is only written by the producer and out_offs only by the consumer.  Each side keeps
+ *  its last view of the other's index next to its own, and only reloads it when that view
+ *  says the ring is full or empty.
+ */
+#define AESD_SPSC_RING_HEAD(name, type, capacity)                  \
+    struct name                                                     \
+    {                                                               \
+        _Alignas(AESD_CACHE_LINE_SIZE) atomic_size_t in_offs;       \
+        size_t cached_out_offs;                                     \
+        _Alignas(AESD_CACHE_LINE_SIZE) atomic_size_t out_offs;      \
+        size_t cached_in_offs;                                      \
+        _Alignas(AESD_CACHE_LINE_SIZE) type entry[capacity];        \
+    }
+
+/**
+ * Generates the operations for struct @param name, prefixed by @param prefix.
+ *
+ * prefix##_init(ring)                         empty the ring, not thread safe
+ * prefix##_count(ring)                        number of stored elements, a snapshot when
+ *                                             called concurrently with either side
+ * prefix##_enqueue_batch(ring, values, n)     producer: copy up to n elements in, returns
+ *                                             how many fit
+ * prefix##_enqueue(ring, value)               producer: returns false when full
+ * prefix##_dequeue_batch(ring, out, n)        consumer: copy up to n elements out, returns
+ *                                             how many were available
+ * prefix##_dequeue(ring, out)                 consumer: returns false when empty
+ */
+#define AESD_SPSC_RING_GENERATE(prefix, name, type, capacity)                                                   \
+    _Static_assert(((capacity) & ((capacity) - 1)) == 0, #name " capacity must be a power of two");            \
+                                                                                                                \
+    static inline void prefix##_init(struct name *ring)                                                         \
+    {                                                                                                           \
+        memset(ring, 0, sizeof(struct name));                                                                   \
+        atomic_init(&ring->in_offs, 0);                                                                         \
+        atomic_init(&ring->out_offs, 0);                                                                        \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t prefix##_count(struct name *ring)                                                      \
+    {                                                                                                           \
+        size_t out_offs = atomic_load_explicit(&ring->out_offs, memory_order_acquire);                         \
+                                                                                                                \
+        return atomic_load_explicit(&ring->in_offs, memory_order_acquire) - out_offs;                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t prefix##_enqueue_batch(struct name *ring, const type *values, size_t n)                \
+    {                                                                                                           \
+        size_t in_offs = atomic_load_explicit(&ring->in_offs, memory_order_relaxed);                           \
+                                                                                                                \
+        if ((capacity) - (in_offs - ring->cached_out_offs) < n)                                                 \
+        {                                                                                                       \
+            ring->cached_out_offs = atomic_load_explicit(&ring->out_offs, memory_order_acquire);               \
+            n = AESD_LOCKFREE_RING_MIN(n, (capacity) - (in_offs - ring->cached_out_offs));                      \
+        }                                                                                                       \
+                                                                                                                \
+        for (size_t i = 0; i < n; ++i)                                                                          \
+        {                                                                                                       \
+            ring->entry[(in_offs + i) & ((capacity) - 1)] = values[i];                                          \
+        }                                                                                                       \
+                                                                                                                \
+        atomic_store_explicit(&ring->in_offs, in_offs + n, memory_order_release);                              \
+                                                                                                                \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline bool prefix##_enqueue(struct name *ring, const type *value)                                   \
+    {                                                                                                           \
+        return prefix##_enqueue_batch(ring, value, 1) == 1;                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t prefix##_dequeue_batch(struct name *ring, type *out, size_t n)                         \
+    {                                                                                                           \
+        size_t out_offs = atomic_load_explicit(&ring->out_offs, memory_order_relaxed);                         \
+                                                                                                                \
+        if (ring->cached_in_offs - out_offs < n)                                                                \
+        {                                                                                                       \
+            ring->cached_in_offs = atomic_load_explicit(&ring->in_offs, memory_order_acquire);                 \
+            n = AESD_LOCKFREE_RING_MIN(n, ring->cached_in_offs - out_offs);                                     \
+        }                                                                                                       \
+                                                                                                                \
+        for (size_t i = 0; i < n; ++i)                                                                          \
+        {                                                                                                       \
+            out[i] = ring->entry[(out_offs + i) & ((capacity) - 1)];                                            \
+        }                                                                                                       \
+                                                                                                                \
+        atomic_store_explicit(&ring->out_offs, out_offs + n, memory_order_release);                            \
+                                                                                                                \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline bool prefix##_dequeue(struct name *ring, type *out)                                           \
+    {                                                                                                           \
+        return prefix##_dequeue_batch(ring, out, 1) == 1;                                                       \
+    }
+
+/**
+ * Declares struct @param name holding up to @param capacity elements of @param type for any
+ * number of producers and one consumer.
+ *  Producers reserve slots by advancing in_offs with compare and swap, then publish each slot
+ *  by storing its position + 1 in the slot's sequence.  The consumer takes slots in order
+ *  while their sequence says they are published, and advancing out_offs hands them back.
+ */
+#define AESD_MPSC_RING_HEAD(name, type, capacity)                  \
+    struct name                                                     \
+    {                                                               \
+        _Alignas(AESD_CACHE_LINE_SIZE) atomic_size_t in_offs;       \
+        _Alignas(AESD_CACHE_LINE_SIZE) atomic_size_t out_offs;      \
+        _Alignas(AESD_CACHE_LINE_SIZE) struct name##_slot           \
+        {                                                           \
+            atomic_size_t sequence;                                 \
+            type value;                                             \
+        } entry[capacity];                                          \
+    }
+
+/**
+ * Generates the operations for struct @param name, prefixed by @param prefix.  The operations
+ * are those of AESD_SPSC_RING_GENERATE, except that the enqueue operations may be called from
+ * any number of threads at once.  A batch is reserved as a whole, so the elements of one
+ * enqueue_batch call are dequeued next to each other.
+ */
+#define AESD_MPSC_RING_GENERATE(prefix, name, type, capacity)                                                   \
+    _Static_assert(((capacity) & ((capacity) - 1)) == 0, #name " capacity must be a power of two");            \
+                                                                                                                \
+    static inline void prefix##_init(struct name *ring)                                                         \
+    {                                                                                                           \
+        memset(ring, 0, sizeof(struct name));                                                                   \
+        atomic_init(&ring->in_offs, 0);                                                                         \
+        atomic_init(&ring->out_offs, 0);                                                                        \
+        for (size_t i = 0; i < (capacity); ++i)                                                                 \
+        {                                                                                                       \
+            atomic_init(&ring->entry[i].sequence, 0);                                                           \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t prefix##_count(struct name *ring)                                                      \
+    {                                                                                                           \
+        size_t out_offs = atomic_load_explicit(&ring->out_offs, memory_order_acquire);                         \
+                                                                                                                \
+        return atomic_load_explicit(&ring->in_offs, memory_order_acquire) - out_offs;                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t prefix##_enqueue_batch(struct name *ring, const type *values, size_t n)                \
+    {                                                                                                           \
+        size_t in_offs = atomic_load_explicit(&ring->in_offs, memory_order_relaxed);                           \
+        size_t reserved;                                                                                        \
+                                                                                                                \
+        do                                                                                                      \
+        {                                                                                                       \
+            size_t out_offs = atomic_load_explicit(&ring->out_offs, memory_order_acquire);                     \
+                                                                                                                \
+            reserved = AESD_LOCKFREE_RING_MIN(n, (capacity) - (in_offs - out_offs));                            \
+            if (reserved == 0)                                                                                  \
+            {                                                                                                   \
+                return 0;                                                                                       \
+            }                                                                                                   \
+        } while (!atomic_compare_exchange_weak_explicit(&ring->in_offs, &in_offs, in_offs + reserved,          \
+                                                        memory_order_relaxed, memory_order_relaxed));           \
+                                                                                                                \
+        for (size_t i = 0; i < reserved; ++i)                                                                   \
+        {                                                                                                       \
+            struct name##_slot *slot = &ring->entry[(in_offs + i) & ((capacity) - 1)];                          \
+                                                                                                                \
+            slot->value = values[i];                                                                            \
+            atomic_store_explicit(&slot->sequence, in_offs + i + 1, memory_order_release);                     \
+        }                                                                                                       \
+                                                                                                                \
+        return reserved;                                                                                        \
+    }                                                                                                           \
+                                                                                                                \
+    static inline bool prefix##_enqueue(struct name *ring, const type *value)                                   \
+    {                                                                                                           \
+        return prefix##_enqueue_batch(ring, value, 1) == 1;                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t prefix##_dequeue_batch(struct name *ring, type *out, size_t n)                         \
+    {                                                                                                           \
+        size_t out_offs = atomic_load_explicit(&ring->out_offs, memory_order_relaxed);                         \
+        size_t i = 0;                                                                                           \
+                                                                                                                \
+        for (; i < n; ++i)                                                                                      \
+        {                                                                                                       \
+            struct name##_slot *slot = &ring->entry[(out_offs + i) & ((capacity) - 1)];                         \
+                                                                                                                \
+            if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != out_offs + i + 1)               \
+            {                                                                                                   \
+                break;                                                                                          \
+            }                                                                                                   \
+                                                                                                                \
+            out[i] = slot->value;                                                                               \
+        }                                                                                                       \
+                                                                                                                \
+        if (i != 0)                                                                                             \
+        {                                                                                                       \
+            atomic_store_explicit(&ring->out_offs, out_offs + i, memory_order_release);                        \
+        }                                                                                                       \
+                                                                                                                \
+        return i;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline bool prefix##_dequeue(struct name *ring, type *out)                                           \
+    {                                                                                                           \
+        return prefix##_dequeue_batch(ring, out, 1) == 1;                                                       \
+    }
+
+#endif /* AESD_LOCKFREE_RING_H */
@@ -0,0 +1,204 @@
+/**
+ * @file aesd-newline-scan.c
+ * @brief Finds '\n' record boundaries, with SSE2 and AVX2 implementations selected at runtime
+ *
+ */
+
+#include "aesd-newline-scan.h"
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+
+size_t aesd_newline_find(const char *buffer, size_t length)
+{
+    const char *newline = memchr(buffer, '\n', length);
+
+    return (newline == NULL) ? length : newline - buffer;
+}
+#else
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AESD_NEWLINE_SCAN_X86 1
+#endif
+
+#define AESD_NEWLINE_WORD_ONES ((uint64_t)0x0101010101010101ULL)
+#define AESD_NEWLINE_WORD_HIGHS ((uint64_t)0x8080808080808080ULL)
+
+static bool aesd_newline_always_supported(void)
+{
+    return true;
+}
+
+/**
+ * Tests eight bytes at a time: a byte of word ^ '\n' is zero exactly where word holds a newline,
+ * and the lowest zero byte is the lowest byte with its high bit set after the subtraction.
+ */
+static size_t aesd_newline_find_scalar(const char *buffer, size_t length)
+{
+    size_t i = 0;
+    uint64_t word;
+    uint64_t matches;
+
+    for (; i + sizeof(word) <= length; i += sizeof(word))
+    {
+        memcpy(&word, buffer + i, sizeof(word));
+        word ^= AESD_NEWLINE_WORD_ONES * '\n';
+        matches = (word - AESD_NEWLINE_WORD_ONES) & ~word & AESD_NEWLINE_WORD_HIGHS;
+        if (matches != 0)
+        {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return i + __builtin_ctzll(matches) / 8;
+#else
+            break;
+#endif
+        }
+    }
+
+    for (; i < length; ++i)
+    {
+        if (buffer[i] == '\n')
+        {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+#ifdef AESD_NEWLINE_SCAN_X86
+static bool aesd_newline_sse2_supported(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2"))) static size_t aesd_newline_find_sse2(const char *buffer, size_t length)
+{
+    const __m128i newlines = _mm_set1_epi8('\n');
+    size_t i = 0;
+    int mask;
+
+    for (; i + sizeof(__m128i) <= length; i += sizeof(__m128i))
+    {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buffer + i)), newlines));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + aesd_newline_find_scalar(buffer + i, length - i);
+}
+
+static bool aesd_newline_avx2_supported(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+/**
+ * Compares two vectors per iteration so the loop is bound by loads rather than the branch
+ */
+__attribute__((target("avx2"))) static size_t aesd_newline_find_avx2(const char *buffer, size_t length)
+{
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    uint32_t low;
+    uint32_t high;
+
+    for (; i + 2 * sizeof(__m256i) <= length; i += 2 * sizeof(__m256i))
+    {
+        low = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + i)), newlines));
+        high = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + i) + 1), newlines));
+        if ((low | high) != 0)
+        {
+            return i + ((low != 0) ? (size_t)__builtin_ctz(low) : sizeof(__m256i) + (size_t)__builtin_ctz(high));
+        }
+    }
+
+    if (i + sizeof(__m256i) <= length)
+    {
+        low = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + i)), newlines));
+        if (low != 0)
+        {
+            return i + __builtin_ctz(low);
+        }
+
+        i += sizeof(__m256i);
+    }
+
+    // Stay in VEX encoded instructions, calling the SSE2 version with dirty upper halves stalls
+    if (i + sizeof(__m128i) <= length)
+    {
+        low = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buffer + i)), _mm256_castsi256_si128(newlines)));
+        if (low != 0)
+        {
+            return i + __builtin_ctz(low);
+        }
+
+        i += sizeof(__m128i);
+    }
+
+    return i + aesd_newline_find_scalar(buffer + i, length - i);
+}
+#endif
+
+const AesdNewlineScanner aesd_newline_scanners[] = {
+#ifdef AESD_NEWLINE_SCAN_X86
+    {.name = "avx2", .find = aesd_newline_find_avx2, .supported = aesd_newline_avx2_supported},
+    {.name = "sse2", .find = aesd_newline_find_sse2, .supported = aesd_newline_sse2_supported},
+#endif
+    {.name = "scalar", .find = aesd_newline_find_scalar, .supported = aesd_newline_always_supported},
+};
+
+const size_t aesd_newline_scanner_count = sizeof(aesd_newline_scanners) / sizeof(aesd_newline_scanners[0]);
+
+/**
+ * Resolved on first use.  Every thread resolves to the same entry, so racing first calls only
+ * repeat the lookup.
+ */
+static const AesdNewlineScanner *aesd_newline_selected = NULL;
+
+const AesdNewlineScanner *aesd_newline_scanner(void)
+{
+    const AesdNewlineScanner *scanner = __atomic_load_n(&aesd_newline_selected, __ATOMIC_ACQUIRE);
+
+    if (scanner == NULL)
+    {
+        scanner = &aesd_newline_scanners[aesd_newline_scanner_count - 1];
+        for (size_t i = 0; i < aesd_newline_scanner_count; ++i)
+        {
+            if (aesd_newline_scanners[i].supported())
+            {
+                scanner = &aesd_newline_scanners[i];
+                break;
+            }
+        }
+
+        __atomic_store_n(&aesd_newline_selected, scanner, __ATOMIC_RELEASE);
+    }
+
+    return scanner;
+}
+
+size_t aesd_newline_find(const char *buffer, size_t length)
+{
+    return aesd_newline_scanner()->find(buffer, length);
+}
+#endif
+
+size_t aesd_newline_count(const char *buffer, size_t length)
+{
+    size_t count = 0;
+    size_t offset = aesd_newline_find(buffer, length);
+
+    while (offset < length)
+    {
+        ++count;
+        ++offset;
+        offset += aesd_newline_find(buffer + offset, length - offset);
+    }
+
+    return count;
+}
@@ -0,0 +1,58 @@
+/*
+ * aesd-newline-scan.h
+ *
+ *  @brief Record boundary scanning shared by the aesdchar driver and aesdsocket
+ *
+ *  Records are terminated by '\n'.  aesd_newline_find returns the offset of the next
+ *  terminator, so every boundary in a chunk is found by calling it again just past the
+ *  previous one.  In user space the implementation is picked on the first call from the
+ *  fastest one the CPU supports; in the kernel it is the architecture's memchr, since
+ *  vector registers are not available to module code without saving the FPU state.
+ */
+
+#ifndef AESD_NEWLINE_SCAN_H
+#define AESD_NEWLINE_SCAN_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#endif
+
+/**
+ * @return the offset of the first '\n' in the @param length bytes at @param buffer, or length
+ *      if there is none
+ */
+extern size_t aesd_newline_find(const char *buffer, size_t length);
+
+/**
+ * @return the number of '\n' in the @param length bytes at @param buffer
+ */
+extern size_t aesd_newline_count(const char *buffer, size_t length);
+
+#ifndef __KERNEL__
+typedef struct AesdNewlineScanner
+{
+    const char *name;
+    size_t (*find)(const char *buffer, size_t length);
+    /**
+     * @return true if the running CPU can execute find
+     */
+    bool (*supported)(void);
+} AesdNewlineScanner;
+
+/**
+ * Every implementation built for this target, in order of preference, ending with the
+ * portable scalar one.  Exposed so benchmarks can compare them directly.
+ */
+extern const AesdNewlineScanner aesd_newline_scanners[];
+extern const size_t aesd_newline_scanner_count;
+
+/**
+ * @return the implementation aesd_newline_find uses on this CPU
+ */
+extern const AesdNewlineScanner *aesd_newline_scanner(void);
+#endif
+
+#endif /* AESD_NEWLINE_SCAN_H */
@@ -0,0 +1,160 @@
+/*
+ * aesd-ring-buffer.h
+ *
+ *  @brief Macro generated fixed capacity ring buffers, in the style of sys/queue.h
+ *
+ *  AESD_RING_HEAD declares the ring structure for an element type and a compile time
+ *  capacity, and AESD_RING_GENERATE emits static inline operations on it under a name
+ *  prefix.  Because the capacity is a constant every index wrap compiles to a mask when it
+ *  is a power of two, and to a multiply by reciprocal otherwise.  No locking is done, any
+ *  necessary locking must be performed by the caller.
+ *
+ *  Example usage:
+ *  typedef AESD_RING_HEAD(int_ring, int, 16, uint8_t) IntRing;
+ *  AESD_RING_GENERATE(int_ring, int_ring, int, 16, AESD_RING_NO_FREE)
+ *
+ *  IntRing ring;
+ *  int_ring_init(&ring);
+ *  int_ring_push(&ring, &value, NULL);
+ */
+
+#ifndef AESD_RING_BUFFER_H
+#define AESD_RING_BUFFER_H
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#endif
+
+/**
+ * Declares struct @param name holding up to @param capacity elements of @param type.
+ * @param index_type must be able to hold capacity - 1.
+ *  entry is the element storage, in_offs is where the next element is pushed, out_offs is
+ *  the oldest element, and full distinguishes a full ring from an empty one when
+ *  in_offs == out_offs.
+ */
+#define AESD_RING_HEAD(name, type, capacity, index_type) \
+    struct name                                           \
+    {                                                     \
+        type entry[capacity];                             \
+        index_type in_offs;                               \
+        index_type out_offs;                              \
+        bool full;                                        \
+    }
+
+/**
+ * Pass as free_fn to AESD_RING_GENERATE for rings that hand evicted elements back to the caller
+ */
+#define AESD_RING_NO_FREE(element) ((void)(element))
+
+/**
+ * Generates the operations for struct @param name, prefixed by @param prefix.
+ * @param free_fn is called with a pointer to each element dropped by push or clear, use
+ *  AESD_RING_NO_FREE when the caller owns evicted elements.
+ *
+ * prefix##_init(ring)               empty the ring without freeing
+ * prefix##_count(ring)              number of stored elements
+ * prefix##_empty(ring)              true when nothing is stored
+ * prefix##_slot(ring, n)            array index of the n-th oldest element, n may wrap
+ * prefix##_get(ring, n)             pointer to the n-th oldest element, NULL if n >= count
+ * prefix##_push(ring, value, out)   store *value, evicting the oldest element when full.
+ *                                   Returns true on eviction and copies it to out if not NULL.
+ * prefix##_pop(ring, out)           remove the oldest element into out if not NULL,
+ *                                   returns false when empty.  free_fn is not called.
+ * prefix##_clear(ring)              free_fn every element, then empty the ring
+ */
+#define AESD_RING_GENERATE(prefix, name, type, capacity, free_fn)                       \
+    static inline void prefix##_init(struct name *ring)                                 \
+    {                                                                                   \
+        memset(ring, 0, sizeof(struct name));                                           \
+    }                                                                                   \
+                                                                                        \
+    static inline size_t prefix##_count(const struct name *ring)                        \
+    {                                                                                   \
+        if (ring->full)                                                                 \
+        {                                                                               \
+            return (capacity);                                                          \
+        }                                                                               \
+                                                                                        \
+        return ((size_t)ring->in_offs + (capacity) - ring->out_offs) % (capacity);      \
+    }                                                                                   \
+                                                                                        \
+    static inline bool prefix##_empty(const struct name *ring)                          \
+    {                                                                                   \
+        return !ring->full && ring->in_offs == ring->out_offs;                          \
+    }                                                                                   \
+                                                                                        \
+    static inline size_t prefix##_slot(const struct name *ring, size_t n)               \
+    {                                                                                   \
+        return ((size_t)ring->out_offs + n) % (capacity);                               \
+    }                                                                                   \
+                                                                                        \
+    static inline type *prefix##_get(struct name *ring, size_t n)                       \
+    {                                                                                   \
+        if (n >= prefix##_count(ring))                                                  \
+        {                                                                               \
+            return NULL;                                                                \
+        }                                                                               \
+                                                                                        \
+        return &ring->entry[prefix##_slot(ring, n)];                                    \
+    }                                                                                   \
+                                                                                        \
+    static inline bool prefix##_push(struct name *ring, const type *value, type *out)   \
+    {                                                                                   \
+        bool evicted = ring->full;                                                      \
+                                                                                        \
+        if (evicted)                                                                    \
+        {                                                                               \
+            if (out != NULL)                                                            \
+            {                                                                           \
+                *out = ring->entry[ring->in_offs];                                      \
+            }                                                                           \
+                                                                                        \
+            free_fn(&ring->entry[ring->in_offs]);                                       \
+            ring->out_offs = (ring->out_offs + 1) % (capacity);                         \
+        }                                                                               \
+                                                                                        \
+        ring->entry[ring->in_offs] = *value;                                            \
+        ring->in_offs = (ring->in_offs + 1) % (capacity);                               \
+        ring->full = (ring->in_offs == ring->out_offs);                                 \
+                                                                                        \
+        return evicted;                                                                 \
+    }                                                                                   \
+                                                                                        \
+    static inline bool prefix##_pop(struct name *ring, type *out)                       \
+    {                                                                                   \
+        if (prefix##_empty(ring))                                                       \
+        {                                                                               \
+            return false;                                                               \
+        }                                                                               \
+                                                                                        \
+        if (out != NULL)                                                                \
+        {                                                                               \
+            *out = ring->entry[ring->out_offs];                                         \
+        }                                                                               \
+                                                                                        \
+        memset(&ring->entry[ring->out_offs], 0, sizeof(type));                          \
+        ring->out_offs = (ring->out_offs + 1) % (capacity);                             \
+        ring->full = false;                                                             \
+                                                                                        \
+        return true;                                                                    \
+    }                                                                                   \
+                                                                                        \
+    static inline void prefix##_clear(struct name *ring)                                \
+    {                                                                                   \
+        size_t count = prefix##_count(ring);                                            \
+                                                                                        \
+        for (size_t n = 0; n < count; ++n)                                              \
+        {                                                                               \
+            free_fn(&ring->entry[prefix##_slot(ring, n)]);                              \
+        }                                                                               \
+                                                                                        \
+        prefix##_init(ring);                                                            \
+    }
+
+#endif /* AESD_RING_BUFFER_H */
@@ -34,14 +34,84 @@ typedef struct aesd_seekto
     uint32_t write_cmd_offset;
 } AesdSeekTo;
 
+/**
+ * Describes one live write command in the history
+ */
+typedef struct aesd_entry_info
+{
+    /**
+     * The byte offset of the command if all commands were concatenated end to end
+     */
+    uint64_t offset;
+    /**
+     * Number of bytes in the command
+     */
+    uint64_t size;
+} AesdEntryInfo;
+
+/**
+ * Passed with AESDCHAR_IOCGHISTORY to read the layout of the whole history in one call
+ */
+typedef struct aesd_history_info
+{
+    /**
+     * User space pointer to an array of entries_len struct aesd_entry_info, filled oldest first
+     */
+    uint64_t entries;
+    uint32_t entries_len;
+    /**
+     * Set to the number of live commands, which may be larger than entries_len
+     */
+    uint32_t entry_count;
+    /**
+     * Set to the total number of bytes in the history
+     */
+    uint64_t total_size;
+    /**
+     * Set to a counter incremented on every commit, used to detect that the layout changed
+     */
+    uint64_t generation;
+} AesdHistoryInfo;
+
+/**
+ * Passed with AESDCHAR_IOCREADCMDS to seek to a command and read a range of commands in one call.
+ * On success the file position is left after the last byte read.
+ */
+typedef struct aesd_read_commands
+{
+    /**
+     * The zero referenced write command to start reading from
+     */
+    uint32_t first_cmd;
+    /**
+     * The maximum number of commands to read
+     */
+    uint32_t cmd_count;
+    /**
+     * User space pointer to buffer_len bytes receiving the commands
+     */
+    uint64_t buffer;
+    uint64_t buffer_len;
+    /**
+     * Set to the number of bytes copied into buffer
+     */
+    uint64_t bytes_read;
+    /**
+     * Set to the generation the commands were read from, see struct aesd_history_info
+     */
+    uint64_t generation;
+} AesdReadCommands;
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+#define AESDCHAR_IOCGHISTORY _IOWR(AESD_IOC_MAGIC, 2, struct aesd_history_info)
+#define AESDCHAR_IOCREADCMDS _IOWR(AESD_IOC_MAGIC, 3, struct aesd_read_commands)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 3
 
 #endif /* AESD_IOCTL_H */
@@ -0,0 +1,70 @@
+/*
+ * aesd_mmap.h
+ *
+ *  @brief Layout of the read-only mapping exported by mmap on aesd char devices
+ *
+ *  The mapping starts with a header page describing the committed history, followed
+ *  by a data ring of AESDCHAR_MMAP_DATA_SIZE bytes which committed entries are copied
+ *  into.  Readers must sample sequence before and after reading; an odd value or a
+ *  changed value means a write was in progress and the read must be retried.
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#include "aesd-circular-buffer.h"
+
+/**
+ * The size of the data ring following the header page, must be a multiple of the page size
+ */
+#define AESDCHAR_MMAP_DATA_SIZE (64 * 1024)
+
+typedef struct aesd_mmap_entry
+{
+    /**
+     * The position of the first byte of this entry in the data ring, counted since the device
+     * was loaded.  The entry starts at data_pos % data_size within the ring.
+     */
+    uint64_t data_pos;
+    /**
+     * Number of bytes in the entry
+     */
+    uint64_t size;
+} AesdMmapEntry;
+
+typedef struct aesd_mmap_header
+{
+    /**
+     * Incremented before and after every update, odd while an update is in progress
+     */
+    uint32_t sequence;
+    /**
+     * Offset of the data ring from the start of the mapping
+     */
+    uint32_t data_offset;
+    /**
+     * Number of bytes in the data ring
+     */
+    uint64_t data_size;
+    /**
+     * Total number of bytes ever written into the data ring.  An entry is only still
+     * present in the ring if data_head - entry.data_pos <= data_size.
+     */
+    uint64_t data_head;
+    /**
+     * Mirrors of the circular buffer state, see AesdCircularBuffer
+     */
+    uint8_t in_offs;
+    uint8_t out_offs;
+    uint8_t full;
+    uint8_t reserved[5];
+    AesdMmapEntry entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+} AesdMmapHeader;
+
+#endif /* AESD_MMAP_H */
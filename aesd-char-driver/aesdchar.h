@@ -10,7 +10,9 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
+#ifndef AESD_NO_DEBUG
 #define AESD_DEBUG 1 // Remove comment on this line to enable debug
+#endif
 
 #undef PDEBUG /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -25,6 +27,35 @@
 #define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * Default for the max_history_bytes module parameter
+ */
+#define AESDCHAR_DEFAULT_MAX_HISTORY_BYTES (1024 * 1024)
+
+/**
+ * Number of buckets in the device_mutex wait time histogram.  Bucket n counts waits shorter
+ * than 2^n microseconds, the last bucket also counts everything longer.
+ */
+#define AESD_MUTEX_WAIT_BUCKETS 16
+
+/**
+ * Counters kept per CPU so the hot paths never share a cache line, summed when read through debugfs
+ */
+typedef struct AesdStats
+{
+     u64 reads;
+     u64 read_bytes;
+     u64 writes;
+     u64 write_bytes;
+     u64 seeks;
+     u64 ioctls;
+     u64 evictions;
+     u64 evicted_bytes;
+     u64 partial_reallocs;
+     u64 mutex_contended;
+     u64 mutex_wait[AESD_MUTEX_WAIT_BUCKETS];
+} AesdStats;
+
 typedef struct AesdDevice
 {
      /**
@@ -33,10 +64,42 @@ typedef struct AesdDevice
      AesdCircularBuffer *buffer;
      struct mutex *device_mutex;
 
+     /**
+      * A partial write left behind by a file that was closed before writing a newline,
+      * prepended to the next entry committed to buffer
+      */
      char *current_write;
      size_t current_write_len;
 
+     /**
+      * Header page followed by the data ring exported through mmap, see aesd_mmap.h
+      */
+     void *mmap_area;
+
+     /**
+      * Incremented each time an entry is committed to buffer, readers waiting in aesd_read_iter or
+      * aesd_poll are woken through commit_queue when it changes
+      */
+     unsigned long generation;
+     wait_queue_head_t commit_queue;
+
+     AesdStats __percpu *stats;
+     struct dentry *debugfs_dir;
+
      struct cdev cdev; /* Char device structure      */
 } AesdDevice;
 
+typedef struct AesdFile
+{
+     AesdDevice *device;
+
+     /**
+      * Partial write staged for this open file until a newline is written.  staging_mutex only
+      * serializes writers sharing this struct file, device_mutex is taken just for the commit.
+      */
+     struct mutex staging_mutex;
+     char *current_write;
+     size_t current_write_len;
+} AesdFile;
+
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
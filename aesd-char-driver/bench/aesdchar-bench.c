@@ -0,0 +1,345 @@
+/**
+ * @file aesdchar-bench.c
+ * @brief Multithreaded benchmark of the aesdchar file operations, run in user space
+ *
+ * Links ../main.c built against shim/ and drives its file operations directly from several
+ * threads, each with its own open file.  Reports throughput and latency for each operation
+ * followed by the driver's own statistics.
+ */
+
+#include "aesd-shim.h"
+
+#include <getopt.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "aesdchar.h"
+#include "aesd_ioctl.h"
+
+#define LATENCY_BUCKETS 64
+#define READ_SIZE 4096
+
+extern AesdDevice aesd_device;
+extern int aesd_init_module(void);
+extern void aesd_cleanup_module(void);
+
+const struct file_operations *aesd_shim_debugfs_fops = NULL;
+void *aesd_shim_debugfs_data = NULL;
+
+typedef enum BenchOperation
+{
+    BENCH_WRITE,
+    BENCH_READ,
+    BENCH_SEEK,
+    BENCH_IOCTL,
+    BENCH_OPERATION_COUNT,
+} BenchOperation;
+
+static const char *const operation_names[BENCH_OPERATION_COUNT] = {"write", "read", "seek", "ioctl"};
+
+typedef struct LatencyHistogram
+{
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    /**
+     * Bucket n counts operations that took less than 2^n nanoseconds
+     */
+    uint64_t bucket[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+typedef struct BenchThread
+{
+    pthread_t thread;
+    unsigned int id;
+    unsigned int weights[BENCH_OPERATION_COUNT];
+    size_t write_size;
+    atomic_bool *should_stop;
+
+    LatencyHistogram latency[BENCH_OPERATION_COUNT];
+    int failed;
+} BenchThread;
+
+static void record_latency(LatencyHistogram *histogram, uint64_t elapsed_ns)
+{
+    histogram->count++;
+    histogram->total_ns += elapsed_ns;
+    if (elapsed_ns > histogram->max_ns)
+    {
+        histogram->max_ns = elapsed_ns;
+    }
+
+    histogram->bucket[fls64(elapsed_ns) < LATENCY_BUCKETS ? fls64(elapsed_ns) : LATENCY_BUCKETS - 1]++;
+}
+
+/**
+ * @return the upper bound in nanoseconds of the bucket containing @param percentile of the samples
+ */
+static uint64_t latency_percentile(const LatencyHistogram *histogram, double percentile)
+{
+    uint64_t target = (uint64_t)(histogram->count * percentile);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        seen += histogram->bucket[i];
+        if (seen > target)
+        {
+            return 1ULL << i;
+        }
+    }
+
+    return histogram->max_ns;
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+
+    return *state;
+}
+
+static BenchOperation pick_operation(const unsigned int *weights, unsigned int total_weight, uint32_t *state)
+{
+    unsigned int pick = next_random(state) % total_weight;
+
+    for (int i = 0; i < BENCH_OPERATION_COUNT; ++i)
+    {
+        if (pick < weights[i])
+        {
+            return (BenchOperation)i;
+        }
+
+        pick -= weights[i];
+    }
+
+    return BENCH_WRITE;
+}
+
+static void *bench_thread_function(void *thread_arguments)
+{
+    BenchThread *bench = (BenchThread *)thread_arguments;
+    const struct file_operations *fops = aesd_device.cdev.ops;
+    struct inode inode = {.i_cdev = &aesd_device.cdev};
+    struct file filp = {.f_flags = O_RDWR};
+    AesdSeekTo seek_to = {0};
+    unsigned int total_weight = 0;
+    uint32_t random_state = 2463534242U + bench->id;
+    char read_buffer[READ_SIZE];
+    char *payload;
+
+    for (int i = 0; i < BENCH_OPERATION_COUNT; ++i)
+    {
+        total_weight += bench->weights[i];
+    }
+
+    payload = malloc(bench->write_size);
+    if (payload == NULL)
+    {
+        perror("malloc");
+        bench->failed = 1;
+        return NULL;
+    }
+
+    memset(payload, 'a' + bench->id % 26, bench->write_size);
+    payload[bench->write_size - 1] = '\n';
+
+    if (fops->open(&inode, &filp) != 0)
+    {
+        fprintf(stderr, "open failed\n");
+        bench->failed = 1;
+        goto open_failed;
+    }
+
+    while (!atomic_load_explicit(bench->should_stop, memory_order_relaxed))
+    {
+        BenchOperation operation = pick_operation(bench->weights, total_weight, &random_state);
+        struct kiocb iocb = {.ki_filp = &filp, .ki_pos = filp.f_pos};
+        struct iov_iter iter;
+        long result = 0;
+        uint64_t start = ktime_get_ns();
+
+        switch (operation)
+        {
+        case BENCH_WRITE:
+            iter = (struct iov_iter){.base = payload, .count = bench->write_size};
+            result = fops->write_iter(&iocb, &iter);
+            filp.f_pos = iocb.ki_pos;
+            break;
+        case BENCH_READ:
+            iocb.ki_pos = 0;
+            iter = (struct iov_iter){.base = read_buffer, .count = sizeof(read_buffer)};
+            result = fops->read_iter(&iocb, &iter);
+            filp.f_pos = iocb.ki_pos;
+            break;
+        case BENCH_SEEK:
+            result = fops->llseek(&filp, 0, SEEK_END);
+            break;
+        case BENCH_IOCTL:
+            result = fops->unlocked_ioctl(&filp, AESDCHAR_IOCSEEKTO, (unsigned long)&seek_to);
+            // An empty history is not an error for the benchmark
+            if (result == -EINVAL)
+            {
+                result = 0;
+            }
+            break;
+        default:
+            break;
+        }
+
+        record_latency(&bench->latency[operation], ktime_get_ns() - start);
+        if (result < 0)
+        {
+            fprintf(stderr, "%s failed: %ld\n", operation_names[operation], result);
+            bench->failed = 1;
+            break;
+        }
+    }
+
+    fops->release(&inode, &filp);
+open_failed:
+    free(payload);
+
+    return NULL;
+}
+
+static int parse_weights(const char *mix, unsigned int *weights)
+{
+    if (sscanf(mix, "%u,%u,%u,%u", &weights[BENCH_WRITE], &weights[BENCH_READ], &weights[BENCH_SEEK], &weights[BENCH_IOCTL]) != 4)
+    {
+        return -1;
+    }
+
+    return (weights[BENCH_WRITE] + weights[BENCH_READ] + weights[BENCH_SEEK] + weights[BENCH_IOCTL] == 0) ? -1 : 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-d seconds] [-s write_size] [-m write,read,seek,ioctl]\n", name);
+    fprintf(stderr, "Defaults: -t 4 -d 5 -s 64 -m 50,40,5,5\n");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int thread_count = 4;
+    unsigned int duration = 5;
+    size_t write_size = 64;
+    unsigned int weights[BENCH_OPERATION_COUNT] = {50, 40, 5, 5};
+    atomic_bool should_stop = false;
+    BenchThread *threads = NULL;
+    unsigned int started = 0;
+    int result = 1;
+    int option;
+
+    while ((option = getopt(argc, argv, "t:d:s:m:h")) != -1)
+    {
+        switch (option)
+        {
+        case 't':
+            thread_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            duration = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            write_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            if (parse_weights(optarg, weights) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (thread_count == 0 || duration == 0 || write_size == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (aesd_init_module() != 0)
+    {
+        fprintf(stderr, "aesd_init_module failed\n");
+        return 1;
+    }
+
+    threads = calloc(thread_count, sizeof(BenchThread));
+    if (threads == NULL)
+    {
+        perror("calloc");
+        goto threads_malloc_failed;
+    }
+
+    for (started = 0; started < thread_count; ++started)
+    {
+        threads[started].id = started;
+        threads[started].write_size = write_size;
+        threads[started].should_stop = &should_stop;
+        memcpy(threads[started].weights, weights, sizeof(weights));
+        if (pthread_create(&threads[started].thread, NULL, bench_thread_function, &threads[started]) != 0)
+        {
+            perror("pthread_create");
+            break;
+        }
+    }
+
+    sleep(duration);
+    atomic_store(&should_stop, true);
+
+    result = (started == thread_count) ? 0 : 1;
+    for (unsigned int i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i].thread, NULL);
+        result |= threads[i].failed;
+    }
+
+    printf("threads: %u, duration: %us, write size: %zu, mix: %u,%u,%u,%u\n", thread_count, duration, write_size,
+           weights[BENCH_WRITE], weights[BENCH_READ], weights[BENCH_SEEK], weights[BENCH_IOCTL]);
+    printf("%-6s %12s %12s %10s %10s %10s %12s\n", "op", "count", "ops/s", "mean_ns", "p50_ns", "p99_ns", "max_ns");
+    for (int operation = 0; operation < BENCH_OPERATION_COUNT; ++operation)
+    {
+        LatencyHistogram total = {0};
+
+        for (unsigned int i = 0; i < started; ++i)
+        {
+            LatencyHistogram *latency = &threads[i].latency[operation];
+
+            total.count += latency->count;
+            total.total_ns += latency->total_ns;
+            total.max_ns = (latency->max_ns > total.max_ns) ? latency->max_ns : total.max_ns;
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; ++bucket)
+            {
+                total.bucket[bucket] += latency->bucket[bucket];
+            }
+        }
+
+        printf("%-6s %12llu %12.0f %10llu %10llu %10llu %12llu\n", operation_names[operation],
+               (unsigned long long)total.count, (double)total.count / duration,
+               (unsigned long long)(total.count ? total.total_ns / total.count : 0),
+               (unsigned long long)latency_percentile(&total, 0.50),
+               (unsigned long long)latency_percentile(&total, 0.99),
+               (unsigned long long)total.max_ns);
+    }
+
+    if (aesd_shim_debugfs_fops != NULL)
+    {
+        struct seq_file seq = {.stream = stdout, .private = aesd_shim_debugfs_data};
+
+        printf("\ndriver statistics:\n");
+        aesd_shim_debugfs_fops->show(&seq, NULL);
+    }
+
+    free(threads);
+threads_malloc_failed:
+    aesd_cleanup_module();
+
+    return result;
+}
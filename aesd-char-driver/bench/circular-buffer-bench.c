@@ -0,0 +1,341 @@
+/**
+ * @file circular-buffer-bench.c
+ * @brief Microbenchmarks of the aesd-circular-buffer.c operations
+ *
+ * Times add_entry into a full buffer, find_entry_offset_for_fpos at every position of the
+ * buffer, next_entry iteration from the oldest entry, and size, for several entry size
+ * distributions.  The capacity is the compile time AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, so
+ * the build produces one executable per capacity.
+ *
+ * Each measurement runs once to warm up and then a number of repetitions, and the median and
+ * minimum ns/op are printed as CSV.  Given a baseline in the same format, every result is
+ * compared against it and the exit status is 1 if any median regressed by more than the
+ * threshold.
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-circular-buffer.h"
+
+#define MAX_REPETITIONS 64
+#define MAX_BASELINE_RESULTS 256
+#define MAX_ENTRY_SIZE 65536
+
+typedef enum SizeDistribution
+{
+    SIZES_FIXED,
+    SIZES_UNIFORM,
+    SIZES_SKEWED,
+    SIZE_DISTRIBUTION_COUNT,
+} SizeDistribution;
+
+/**
+ * fixed: every entry is a 32 byte line.  uniform: 1 to 4096 bytes.  skewed: mostly short lines
+ * with one in ten between 4 KiB and 64 KiB, like a log with the occasional dump.
+ */
+static const char *const distribution_names[SIZE_DISTRIBUTION_COUNT] = {"fixed", "uniform", "skewed"};
+
+typedef enum BenchOperation
+{
+    BENCH_ADD_ENTRY,
+    BENCH_FIND_FPOS,
+    BENCH_NEXT_ENTRY,
+    BENCH_SIZE,
+    BENCH_OPERATION_COUNT,
+} BenchOperation;
+
+static const char *const operation_names[BENCH_OPERATION_COUNT] = {"add_entry", "find_fpos", "next_entry", "size"};
+
+typedef struct BenchResult
+{
+    char distribution[16];
+    char operation[16];
+    unsigned int capacity;
+    double median_ns;
+} BenchResult;
+
+static char entry_data[MAX_ENTRY_SIZE];
+static volatile size_t sink;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * A xorshift generator, seeded the same way every run so every run sees the same sizes
+ */
+static size_t next_size(SizeDistribution distribution, uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    switch (distribution)
+    {
+    case SIZES_UNIFORM:
+        return 1 + *state % 4096;
+    case SIZES_SKEWED:
+        return (*state % 10 == 0) ? 4096 + (*state >> 8) % (MAX_ENTRY_SIZE - 4096) : 8 + (*state >> 8) % 57;
+    default:
+        return 32;
+    }
+}
+
+static void fill_buffer(AesdCircularBuffer *buffer, SizeDistribution distribution, uint64_t *state)
+{
+    aesd_circular_buffer_init(buffer);
+    for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; ++i)
+    {
+        AesdBufferEntry entry = {.buffptr = entry_data, .size = next_size(distribution, state)};
+
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+}
+
+/**
+ * Runs about @param iterations of @param operation on a full buffer
+ * @return the elapsed nanoseconds and, in @param operations, how many operations they covered
+ */
+static uint64_t run_operation(BenchOperation operation, SizeDistribution distribution, size_t iterations, size_t *operations)
+{
+    AesdCircularBuffer buffer;
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    AesdBufferEntry *entry;
+    size_t total = 0;
+    size_t offset_in_entry;
+    uint64_t start;
+    uint64_t elapsed;
+
+    fill_buffer(&buffer, distribution, &state);
+    *operations = 0;
+
+    switch (operation)
+    {
+    case BENCH_ADD_ENTRY:
+    {
+        // Sizes are drawn up front so the generator is not part of the measurement
+        AesdBufferEntry *entries = malloc(iterations * sizeof(AesdBufferEntry));
+        if (entries == NULL)
+        {
+            return 0;
+        }
+
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            entries[i] = (AesdBufferEntry){.buffptr = entry_data, .size = next_size(distribution, &state)};
+        }
+
+        start = now_ns();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            total += (size_t)aesd_circular_buffer_add_entry(&buffer, &entries[i]);
+        }
+        elapsed = now_ns() - start;
+
+        free(entries);
+        *operations = iterations;
+        break;
+    }
+    case BENCH_FIND_FPOS:
+    {
+        // Looks up every byte position held in the buffer, in as many passes as fit iterations
+        size_t size = aesd_circular_buffer_size(&buffer);
+        size_t passes = (iterations > size) ? iterations / size : 1;
+
+        start = now_ns();
+        for (size_t i = 0; i < passes; ++i)
+        {
+            for (size_t position = 0; position < size; ++position)
+            {
+                total += (size_t)aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, position, &offset_in_entry) + offset_in_entry;
+            }
+        }
+        elapsed = now_ns() - start;
+
+        *operations = passes * size;
+        break;
+    }
+    case BENCH_NEXT_ENTRY:
+        // One iteration walks from the oldest entry to the end, one operation per step
+        start = now_ns();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            for (entry = &buffer.entry[buffer.out_offs]; entry != NULL; entry = aesd_circular_buffer_next_entry(&buffer, entry))
+            {
+                total += entry->size;
+            }
+        }
+        elapsed = now_ns() - start;
+
+        *operations = iterations * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        break;
+    default:
+        start = now_ns();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            total += aesd_circular_buffer_size(&buffer);
+            // Keeps the call inside the loop, the compiler cannot tell it has no side effects
+            __asm__ volatile("" : : "r"(&buffer) : "memory");
+        }
+        elapsed = now_ns() - start;
+
+        *operations = iterations;
+        break;
+    }
+
+    sink = total;
+
+    return elapsed;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double a_value = *(const double *)a;
+    double b_value = *(const double *)b;
+
+    return (a_value > b_value) - (a_value < b_value);
+}
+
+/**
+ * @return the number of results read from @param path, or -1 if it could not be read
+ */
+static int read_baseline(const char *path, BenchResult *results)
+{
+    FILE *file = fopen(path, "r");
+    char line[256];
+    int count = 0;
+
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (count < MAX_BASELINE_RESULTS && fgets(line, sizeof(line), file) != NULL)
+    {
+        BenchResult *result = &results[count];
+
+        if (sscanf(line, "%u,%15[^,],%15[^,],%lf", &result->capacity, result->distribution, result->operation, &result->median_ns) == 4)
+        {
+            ++count;
+        }
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+static const BenchResult *find_baseline(const BenchResult *baseline, int baseline_count, const char *distribution, const char *operation)
+{
+    for (int i = 0; i < baseline_count; ++i)
+    {
+        if (baseline[i].capacity == AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED &&
+            strcmp(baseline[i].distribution, distribution) == 0 && strcmp(baseline[i].operation, operation) == 0)
+        {
+            return &baseline[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-r repetitions, at most %d] [-b baseline.csv] [-t threshold percent] [-H]\n", name, MAX_REPETITIONS);
+    fprintf(stderr, "Defaults: -n 200000 -r 7 -t 10, -H leaves out the CSV header\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static BenchResult baseline[MAX_BASELINE_RESULTS];
+    int baseline_count = 0;
+    size_t iterations = 200000;
+    unsigned int repetitions = 7;
+    double threshold = 10.0;
+    bool header = true;
+    int result = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:r:b:t:Hh")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            repetitions = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            baseline_count = read_baseline(optarg, baseline);
+            if (baseline_count < 0)
+            {
+                return 1;
+            }
+            break;
+        case 't':
+            threshold = strtod(optarg, NULL);
+            break;
+        case 'H':
+            header = false;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (iterations == 0 || repetitions == 0 || repetitions > MAX_REPETITIONS)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (header)
+    {
+        printf("capacity,distribution,operation,median_ns_per_op,min_ns_per_op,repetitions\n");
+    }
+
+    for (int distribution = 0; distribution < SIZE_DISTRIBUTION_COUNT; ++distribution)
+    {
+        for (int operation = 0; operation < BENCH_OPERATION_COUNT; ++operation)
+        {
+            double ns_per_op[MAX_REPETITIONS];
+            size_t operations;
+            const BenchResult *reference;
+
+            run_operation(operation, distribution, iterations, &operations);
+            for (unsigned int r = 0; r < repetitions; ++r)
+            {
+                uint64_t elapsed = run_operation(operation, distribution, iterations, &operations);
+
+                ns_per_op[r] = (operations == 0) ? 0.0 : (double)elapsed / operations;
+            }
+
+            qsort(ns_per_op, repetitions, sizeof(double), compare_double);
+            printf("%u,%s,%s,%.3f,%.3f,%u\n", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, distribution_names[distribution],
+                   operation_names[operation], ns_per_op[repetitions / 2], ns_per_op[0], repetitions);
+
+            reference = find_baseline(baseline, baseline_count, distribution_names[distribution], operation_names[operation]);
+            if (reference != NULL && ns_per_op[repetitions / 2] > reference->median_ns * (1.0 + threshold / 100.0))
+            {
+                fprintf(stderr, "regression: %u,%s,%s %.3f ns/op against a baseline of %.3f\n", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+                        distribution_names[distribution], operation_names[operation], ns_per_op[repetitions / 2], reference->median_ns);
+                result = 1;
+            }
+        }
+    }
+
+    return result;
+}
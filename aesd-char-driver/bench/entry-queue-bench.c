@@ -0,0 +1,310 @@
+/**
+ * @file entry-queue-bench.c
+ * @brief Throughput of the lock-free entry queues against a mutex protected ring
+ *
+ * Producer threads push AesdBufferEntry values to a single consumer through each queue, in
+ * batches of a configurable size.  The consumer checks every producer's entries arrive in
+ * order and none are lost, then the time to drain them all is reported.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-entry-queue.h"
+
+#define MAX_BATCH 256
+
+typedef AESD_RING_HEAD(locked_entry_ring, AesdBufferEntry, AESD_ENTRY_QUEUE_CAPACITY, uint16_t) LockedEntryRing;
+AESD_RING_GENERATE(locked_entry_ring, locked_entry_ring, AesdBufferEntry, AESD_ENTRY_QUEUE_CAPACITY, AESD_RING_NO_FREE)
+
+/**
+ * The baseline: the same ring aesd-ring-buffer.h generates for the driver, behind a mutex
+ */
+typedef struct LockedEntryQueue
+{
+    pthread_mutex_t mutex;
+    LockedEntryRing ring;
+} LockedEntryQueue;
+
+static size_t locked_enqueue_batch(LockedEntryQueue *queue, const AesdBufferEntry *values, size_t n)
+{
+    size_t pushed = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+    for (; pushed < n && !queue->ring.full; ++pushed)
+    {
+        locked_entry_ring_push(&queue->ring, &values[pushed], NULL);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pushed;
+}
+
+static size_t locked_dequeue_batch(LockedEntryQueue *queue, AesdBufferEntry *out, size_t n)
+{
+    size_t popped = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (popped < n && locked_entry_ring_pop(&queue->ring, &out[popped]))
+    {
+        ++popped;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return popped;
+}
+
+typedef enum QueueKind
+{
+    QUEUE_MUTEX,
+    QUEUE_SPSC,
+    QUEUE_MPSC,
+    QUEUE_KIND_COUNT,
+} QueueKind;
+
+static const char *const queue_names[QUEUE_KIND_COUNT] = {"mutex", "spsc", "mpsc"};
+
+typedef struct BenchQueue
+{
+    QueueKind kind;
+    LockedEntryQueue locked;
+    AesdEntrySpscQueue spsc;
+    AesdEntryMpscQueue mpsc;
+} BenchQueue;
+
+static size_t enqueue_batch(BenchQueue *queue, const AesdBufferEntry *values, size_t n)
+{
+    switch (queue->kind)
+    {
+    case QUEUE_SPSC:
+        return aesd_entry_spsc_enqueue_batch(&queue->spsc, values, n);
+    case QUEUE_MPSC:
+        return aesd_entry_mpsc_enqueue_batch(&queue->mpsc, values, n);
+    default:
+        return locked_enqueue_batch(&queue->locked, values, n);
+    }
+}
+
+static size_t dequeue_batch(BenchQueue *queue, AesdBufferEntry *out, size_t n)
+{
+    switch (queue->kind)
+    {
+    case QUEUE_SPSC:
+        return aesd_entry_spsc_dequeue_batch(&queue->spsc, out, n);
+    case QUEUE_MPSC:
+        return aesd_entry_mpsc_dequeue_batch(&queue->mpsc, out, n);
+    default:
+        return locked_dequeue_batch(&queue->locked, out, n);
+    }
+}
+
+typedef struct Producer
+{
+    pthread_t thread;
+    BenchQueue *queue;
+    size_t id;
+    size_t items;
+    size_t batch;
+} Producer;
+
+/**
+ * Entries carry the producer in size and a per producer sequence number in offset
+ */
+static void *producer_thread_function(void *thread_arguments)
+{
+    Producer *producer = (Producer *)thread_arguments;
+    AesdBufferEntry values[MAX_BATCH];
+    size_t sent = 0;
+
+    while (sent < producer->items)
+    {
+        size_t n = (producer->items - sent < producer->batch) ? producer->items - sent : producer->batch;
+        size_t pushed = 0;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            values[i] = (AesdBufferEntry){.size = producer->id, .offset = sent + i};
+        }
+
+        while (pushed < n)
+        {
+            size_t count = enqueue_batch(producer->queue, values + pushed, n - pushed);
+
+            if (count == 0)
+            {
+                sched_yield();
+            }
+
+            pushed += count;
+        }
+
+        sent += n;
+    }
+
+    return NULL;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @return the elapsed nanoseconds, or 0 if entries were lost or reordered
+ */
+static uint64_t run_queue(BenchQueue *queue, size_t producer_count, size_t items, size_t batch)
+{
+    Producer *producers = calloc(producer_count, sizeof(Producer));
+    size_t *expected = calloc(producer_count, sizeof(size_t));
+    AesdBufferEntry out[MAX_BATCH];
+    size_t received = 0;
+    size_t started = 0;
+    bool in_order = true;
+    uint64_t start;
+    uint64_t elapsed = 0;
+
+    if (producers == NULL || expected == NULL)
+    {
+        perror("calloc");
+        goto alloc_failed;
+    }
+
+    start = now_ns();
+    for (; started < producer_count; ++started)
+    {
+        producers[started] = (Producer){.queue = queue, .id = started, .items = items, .batch = batch};
+        if (pthread_create(&producers[started].thread, NULL, producer_thread_function, &producers[started]) != 0)
+        {
+            perror("pthread_create");
+            break;
+        }
+    }
+
+    while (received < started * items)
+    {
+        size_t count = dequeue_batch(queue, out, batch);
+
+        if (count == 0)
+        {
+            sched_yield();
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            in_order &= out[i].offset == expected[out[i].size]++;
+        }
+
+        received += count;
+    }
+
+    elapsed = now_ns() - start;
+    for (size_t i = 0; i < started; ++i)
+    {
+        pthread_join(producers[i].thread, NULL);
+    }
+
+    if (!in_order || started != producer_count)
+    {
+        elapsed = 0;
+    }
+
+alloc_failed:
+    free(expected);
+    free(producers);
+
+    return elapsed;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-p producers] [-n items per producer] [-b batch, at most %d]\n", name, MAX_BATCH);
+    fprintf(stderr, "Defaults: -p 1 -n 10000000 -b 1\n");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t producer_count = 1;
+    size_t items = 10000000;
+    size_t batch = 1;
+    BenchQueue *queue;
+    int result = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "p:n:b:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'p':
+            producer_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            items = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (producer_count == 0 || items == 0 || batch == 0 || batch > MAX_BATCH)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Holds cache line aligned members, so it cannot come from plain malloc
+    queue = aligned_alloc(AESD_CACHE_LINE_SIZE, (sizeof(BenchQueue) + AESD_CACHE_LINE_SIZE - 1) & ~(size_t)(AESD_CACHE_LINE_SIZE - 1));
+    if (queue == NULL)
+    {
+        perror("aligned_alloc");
+        return 1;
+    }
+
+    printf("producers: %zu, items per producer: %zu, batch: %zu\n", producer_count, items, batch);
+    printf("%-6s %12s %14s\n", "queue", "ms", "Mentries/s");
+    for (int kind = 0; kind < QUEUE_KIND_COUNT; ++kind)
+    {
+        uint64_t elapsed;
+
+        // The single producer queue is only valid with one producer
+        if (kind == QUEUE_SPSC && producer_count != 1)
+        {
+            continue;
+        }
+
+        memset(queue, 0, sizeof(BenchQueue));
+        queue->kind = kind;
+        pthread_mutex_init(&queue->locked.mutex, NULL);
+        locked_entry_ring_init(&queue->locked.ring);
+        aesd_entry_spsc_init(&queue->spsc);
+        aesd_entry_mpsc_init(&queue->mpsc);
+
+        elapsed = run_queue(queue, producer_count, items, batch);
+        pthread_mutex_destroy(&queue->locked.mutex);
+        if (elapsed == 0)
+        {
+            fprintf(stderr, "%s lost or reordered entries\n", queue_names[kind]);
+            result = 1;
+            continue;
+        }
+
+        printf("%-6s %12.1f %14.2f\n", queue_names[kind], elapsed / 1e6, (double)(producer_count * items) * 1e3 / elapsed);
+    }
+
+    free(queue);
+
+    return result;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file newline-scan-bench.c
+ * @brief Compares the aesd_newline_find implementations against memchr
+ *
+ * Each implementation walks every record boundary in a buffer, for a range of buffer sizes
+ * and record lengths, and reports throughput.  Results are checked against memchr first.
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-newline-scan.h"
+
+static size_t find_memchr(const char *buffer, size_t length)
+{
+    const char *newline = memchr(buffer, '\n', length);
+
+    return (newline == NULL) ? length : (size_t)(newline - buffer);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @return the number of boundaries found, so the scan cannot be optimized away
+ */
+static size_t scan_all(size_t (*find)(const char *, size_t), const char *buffer, size_t length)
+{
+    size_t found = 0;
+    size_t offset = find(buffer, length);
+
+    while (offset < length)
+    {
+        ++found;
+        ++offset;
+        offset += find(buffer + offset, length - offset);
+    }
+
+    return found;
+}
+
+/**
+ * Fills @param buffer with printable bytes and a newline every @param record_length bytes, or
+ * none at all when record_length is 0
+ */
+static void fill_buffer(char *buffer, size_t length, size_t record_length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        buffer[i] = 'a' + i % 26;
+        if (record_length != 0 && i % record_length == record_length - 1)
+        {
+            buffer[i] = '\n';
+        }
+    }
+}
+
+static double bench_find(size_t (*find)(const char *, size_t), const char *buffer, size_t length, size_t expected,
+                         uint64_t min_ns)
+{
+    uint64_t bytes = 0;
+    uint64_t start = now_ns();
+    uint64_t elapsed;
+
+    do
+    {
+        if (scan_all(find, buffer, length) != expected)
+        {
+            return -1;
+        }
+
+        bytes += length;
+        elapsed = now_ns() - start;
+    } while (elapsed < min_ns);
+
+    return (double)bytes / elapsed;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-d milliseconds per case]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t lengths[] = {64, 512, 4096, 65536, 1048576};
+    static const size_t record_lengths[] = {0, 16, 80, 1024};
+    uint64_t min_ns = 100 * 1000000ULL;
+    int result = 0;
+    int option;
+    char *buffer;
+
+    while ((option = getopt(argc, argv, "d:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            min_ns = strtoull(optarg, NULL, 10) * 1000000ULL;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    buffer = malloc(lengths[sizeof(lengths) / sizeof(lengths[0]) - 1]);
+    if (buffer == NULL)
+    {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("selected: %s\n", aesd_newline_scanner()->name);
+    printf("%-8s %10s %10s %12s\n", "impl", "length", "record", "GB/s");
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l)
+    {
+        for (size_t r = 0; r < sizeof(record_lengths) / sizeof(record_lengths[0]); ++r)
+        {
+            size_t expected;
+
+            if (record_lengths[r] > lengths[l])
+            {
+                continue;
+            }
+
+            fill_buffer(buffer, lengths[l], record_lengths[r]);
+            expected = scan_all(find_memchr, buffer, lengths[l]);
+            printf("%-8s %10zu %10zu %12.2f\n", "memchr", lengths[l], record_lengths[r],
+                   bench_find(find_memchr, buffer, lengths[l], expected, min_ns));
+
+            for (size_t i = 0; i < aesd_newline_scanner_count; ++i)
+            {
+                const AesdNewlineScanner *scanner = &aesd_newline_scanners[i];
+                double throughput;
+
+                if (!scanner->supported())
+                {
+                    continue;
+                }
+
+                throughput = bench_find(scanner->find, buffer, lengths[l], expected, min_ns);
+                if (throughput < 0)
+                {
+                    fprintf(stderr, "%s found a different number of newlines than memchr\n", scanner->name);
+                    result = 1;
+                    continue;
+                }
+
+                printf("%-8s %10zu %10zu %12.2f\n", scanner->name, lengths[l], record_lengths[r], throughput);
+            }
+        }
+    }
+
+    free(buffer);
+
+    return result;
+}
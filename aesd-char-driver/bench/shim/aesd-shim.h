@@ -0,0 +1,400 @@
+/**
+ * @file aesd-shim.h
+ * @brief User space stand-ins for the kernel APIs used by main.c
+ *
+ * Every header under shim/linux includes this file, so main.c builds unmodified as a plain
+ * user space object.  Only the behavior the driver relies on is modelled: mutexes and wait
+ * queues map onto pthreads, allocators onto malloc, and user copies onto memcpy.
+ */
+
+#ifndef AESD_SHIM_H
+#define AESD_SHIM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef unsigned int __poll_t;
+
+#define __user
+#define __percpu
+
+#define ERESTARTSYS 512
+
+#define KERN_ERR
+#define KERN_WARNING
+#define KERN_DEBUG
+#define printk(fmt, args...) fprintf(stderr, fmt, ##args)
+
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 1, 0)
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+
+struct module;
+#define THIS_MODULE ((struct module *)NULL)
+#define module_init(fn)
+#define module_exit(fn)
+
+#define PAGE_SIZE 4096UL
+#define NSEC_PER_USEC 1000ULL
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) min((type)(a), (type)(b))
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, value) __atomic_store_n(&(x), (value), __ATOMIC_RELAXED)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+static inline int fls64(u64 value)
+{
+    return (value == 0) ? 0 : 64 - __builtin_clzll(value);
+}
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Allocation
+ */
+#define GFP_KERNEL 0
+#define kmalloc(size, flags) malloc(size)
+#define kmalloc_array(count, size, flags) calloc(count, size)
+#define krealloc(pointer, size, flags) realloc(pointer, size)
+#define kfree(pointer) free((void *)(pointer))
+#define kvmalloc(size, flags) malloc(size)
+#define kvfree(pointer) free((void *)(pointer))
+#define vmalloc_user(size) calloc(1, size)
+#define vfree(pointer) free(pointer)
+
+struct kmem_cache
+{
+    size_t size;
+};
+
+static inline struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                                   unsigned long flags, void (*ctor)(void *))
+{
+    struct kmem_cache *cache = malloc(sizeof(struct kmem_cache));
+    if (cache != NULL)
+    {
+        cache->size = size;
+    }
+
+    return cache;
+}
+
+#define kmem_cache_alloc(cache, flags) malloc((cache)->size)
+#define kmem_cache_free(cache, pointer) free(pointer)
+#define kmem_cache_destroy(cache) free(cache)
+
+/*
+ * Per CPU data is laid out as one fixed size unit per CPU, like the kernel's percpu allocator.
+ * Updates are atomic since threads can migrate between reading the CPU and the add.
+ */
+#define AESD_SHIM_NR_CPUS 64
+#define AESD_SHIM_PERCPU_UNIT 4096
+
+static inline void *aesd_shim_alloc_percpu(size_t size)
+{
+    return (size > AESD_SHIM_PERCPU_UNIT) ? NULL : calloc(AESD_SHIM_NR_CPUS, AESD_SHIM_PERCPU_UNIT);
+}
+
+static inline size_t aesd_shim_this_cpu_offset(void)
+{
+    int cpu = sched_getcpu();
+
+    return (size_t)((cpu < 0) ? 0 : cpu % AESD_SHIM_NR_CPUS) * AESD_SHIM_PERCPU_UNIT;
+}
+
+#define alloc_percpu(type) ((type *)aesd_shim_alloc_percpu(sizeof(type)))
+#define free_percpu(pointer) free(pointer)
+#define per_cpu_ptr(pointer, cpu) ((__typeof__(pointer))((char *)(pointer) + (size_t)(cpu) * AESD_SHIM_PERCPU_UNIT))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < AESD_SHIM_NR_CPUS; ++(cpu))
+#define this_cpu_add(pcp, value) \
+    __atomic_fetch_add((__typeof__(&(pcp)))((char *)&(pcp) + aesd_shim_this_cpu_offset()), (value), __ATOMIC_RELAXED)
+#define this_cpu_inc(pcp) this_cpu_add(pcp, 1)
+
+/*
+ * Locking and waiting
+ */
+struct mutex
+{
+    pthread_mutex_t lock;
+};
+
+#define mutex_init(mutex) pthread_mutex_init(&(mutex)->lock, NULL)
+#define mutex_destroy(mutex) pthread_mutex_destroy(&(mutex)->lock)
+#define mutex_lock(mutex) pthread_mutex_lock(&(mutex)->lock)
+#define mutex_lock_interruptible(mutex) pthread_mutex_lock(&(mutex)->lock)
+#define mutex_trylock(mutex) (pthread_mutex_trylock(&(mutex)->lock) == 0)
+#define mutex_unlock(mutex) pthread_mutex_unlock(&(mutex)->lock)
+
+typedef struct wait_queue_head
+{
+    pthread_mutex_t lock;
+    pthread_cond_t condition;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(queue)                       \
+    do                                                   \
+    {                                                    \
+        pthread_mutex_init(&(queue)->lock, NULL);        \
+        pthread_cond_init(&(queue)->condition, NULL);    \
+    } while (0)
+
+#define wake_up_interruptible(queue)                     \
+    do                                                   \
+    {                                                    \
+        pthread_mutex_lock(&(queue)->lock);              \
+        pthread_cond_broadcast(&(queue)->condition);     \
+        pthread_mutex_unlock(&(queue)->lock);            \
+    } while (0)
+
+#define wait_event_interruptible(queue, condition_expr)                 \
+    ({                                                                  \
+        pthread_mutex_lock(&(queue).lock);                              \
+        while (!(condition_expr))                                       \
+        {                                                               \
+            pthread_cond_wait(&(queue).condition, &(queue).lock);       \
+        }                                                               \
+        pthread_mutex_unlock(&(queue).lock);                            \
+        0;                                                              \
+    })
+
+/*
+ * User copies and iterators, user space pointers are plain pointers here
+ */
+#define copy_to_user(to, from, size) (memcpy((to), (from), (size)), 0UL)
+#define copy_from_user(to, from, size) (memcpy((to), (from), (size)), 0UL)
+#define u64_to_user_ptr(value) ((void *)(uintptr_t)(value))
+
+struct iov_iter
+{
+    char *base;
+    size_t count;
+};
+
+static inline size_t iov_iter_count(const struct iov_iter *iter)
+{
+    return iter->count;
+}
+
+static inline size_t copy_to_iter(const void *from, size_t size, struct iov_iter *iter)
+{
+    size = min(size, iter->count);
+    memcpy(iter->base, from, size);
+    iter->base += size;
+    iter->count -= size;
+
+    return size;
+}
+
+static inline bool copy_from_iter_full(void *to, size_t size, struct iov_iter *iter)
+{
+    if (size > iter->count)
+    {
+        return false;
+    }
+
+    memcpy(to, iter->base, size);
+    iter->base += size;
+    iter->count -= size;
+
+    return true;
+}
+
+/*
+ * Files
+ */
+struct cdev;
+struct seq_file;
+struct poll_table_struct;
+
+struct inode
+{
+    struct cdev *i_cdev;
+    void *i_private;
+};
+
+struct file
+{
+    unsigned int f_flags;
+    loff_t f_pos;
+    void *private_data;
+};
+
+#define IOCB_NOWAIT (1 << 7)
+
+struct kiocb
+{
+    struct file *ki_filp;
+    loff_t ki_pos;
+    int ki_flags;
+};
+
+#define VM_WRITE 0x00000002UL
+#define VM_MAYWRITE 0x00000020UL
+
+struct vm_area_struct
+{
+    unsigned long vm_start;
+    unsigned long vm_end;
+    unsigned long vm_pgoff;
+    unsigned long vm_flags;
+};
+
+// There is no page table to map into, mmap is only exercised for its checks
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *area, unsigned long pgoff)
+{
+    return (area == NULL) ? -EINVAL : 0;
+}
+
+struct file_operations
+{
+    struct module *owner;
+    ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+    void *splice_read;
+    void *splice_write;
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+    loff_t (*llseek)(struct file *, loff_t, int);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    __poll_t (*poll)(struct file *, struct poll_table_struct *);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+    int (*show)(struct seq_file *, void *);
+};
+
+#define generic_file_splice_read NULL
+#define copy_splice_read NULL
+#define iter_file_splice_write NULL
+
+static inline loff_t fixed_size_llseek(struct file *filp, loff_t offset, int whence, loff_t size)
+{
+    switch (whence)
+    {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += filp->f_pos;
+        break;
+    case SEEK_END:
+        offset += size;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (offset < 0 || offset > size)
+    {
+        return -EINVAL;
+    }
+
+    filp->f_pos = offset;
+
+    return offset;
+}
+
+#define poll_wait(filp, queue, table)
+
+/*
+ * Character device registration is a no-op, callers reach the file operations through
+ * aesd_device.cdev.ops
+ */
+#define MINORBITS 20
+#define MKDEV(major, minor) (((major) << MINORBITS) | (minor))
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+
+struct cdev
+{
+    struct module *owner;
+    const struct file_operations *ops;
+};
+
+static inline void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+    cdev->ops = fops;
+}
+
+static inline int cdev_add(struct cdev *cdev, dev_t devno, unsigned int count)
+{
+    return 0;
+}
+
+static inline void cdev_del(struct cdev *cdev)
+{
+}
+
+static inline int alloc_chrdev_region(dev_t *dev, unsigned int minor, unsigned int count, const char *name)
+{
+    *dev = MKDEV(240, minor);
+
+    return 0;
+}
+
+static inline void unregister_chrdev_region(dev_t dev, unsigned int count)
+{
+}
+
+/*
+ * debugfs and seq_file, the last file created is kept so a harness can print it
+ */
+struct dentry;
+
+struct seq_file
+{
+    FILE *stream;
+    void *private;
+};
+
+#define seq_printf(seq, fmt, args...) fprintf((seq)->stream, fmt, ##args)
+#define seq_puts(seq, string) fputs(string, (seq)->stream)
+
+#define DEFINE_SHOW_ATTRIBUTE(__name) \
+    static const struct file_operations __name##_fops = {.show = __name##_show}
+
+extern const struct file_operations *aesd_shim_debugfs_fops;
+extern void *aesd_shim_debugfs_data;
+
+static inline struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+    return NULL;
+}
+
+static inline struct dentry *debugfs_create_file(const char *name, unsigned int mode, struct dentry *parent,
+                                                 void *data, const struct file_operations *fops)
+{
+    aesd_shim_debugfs_fops = fops;
+    aesd_shim_debugfs_data = data;
+
+    return NULL;
+}
+
+static inline void debugfs_remove_recursive(struct dentry *dentry)
+{
+}
+
+#endif /* AESD_SHIM_H */
@@ -13,10 +13,23 @@
 #include <linux/printk.h>
 #include <linux/types.h>
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
 #include <linux/fs.h> // file_operations
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/wait.h>
 
 #include "aesdchar.h"
 #include "aesd_ioctl.h"
+#include "aesd_mmap.h"
+#include "aesd-newline-scan.h"
 
 #ifndef __KERNEL__
 #ifdef AESD_DEBUG
@@ -27,157 +40,710 @@
 int aesd_major = 0; // use dynamic major
 int aesd_minor = 0;
 
+static bool follow_reads = false;
+static unsigned long max_history_bytes = AESDCHAR_DEFAULT_MAX_HISTORY_BYTES;
+
 #ifdef __KERNEL__
 MODULE_AUTHOR("Sean Sweet");
 MODULE_LICENSE("Dual BSD/GPL");
+
+module_param(follow_reads, bool, 0644);
+MODULE_PARM_DESC(follow_reads, "Block reads at the end of the history until a new entry is committed, like tail -f");
+module_param(max_history_bytes, ulong, 0644);
+MODULE_PARM_DESC(max_history_bytes, "Maximum bytes held by the history and by a partial write, 0 for no limit");
 #endif
 
 AesdDevice aesd_device;
 
+/**
+ * Entry buffers up to the largest size class come from a dedicated slab cache for their class,
+ * larger ones from kmalloc.  The class of a buffer is always derived from the number of bytes
+ * it holds, so staged writes only move to a new buffer when they outgrow their class.
+ */
+static const size_t aesd_entry_size_classes[] = {32, 128, 512, 2048};
+static const char *const aesd_entry_cache_names[] = {"aesdchar_entry_32", "aesdchar_entry_128", "aesdchar_entry_512", "aesdchar_entry_2048"};
+static struct kmem_cache *aesd_entry_caches[ARRAY_SIZE(aesd_entry_size_classes)];
+
+static int aesd_entry_size_class(size_t size)
+{
+    for (int i = 0; i < ARRAY_SIZE(aesd_entry_size_classes); ++i)
+    {
+        if (size <= aesd_entry_size_classes[i])
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @return the number of bytes a buffer holding @param size bytes can grow to without moving
+ */
+static size_t aesd_entry_capacity(size_t size)
+{
+    int size_class = aesd_entry_size_class(size);
+
+    return (size_class < 0) ? size : aesd_entry_size_classes[size_class];
+}
+
+static char *aesd_entry_alloc(size_t size)
+{
+    int size_class = aesd_entry_size_class(size);
+
+    if (size_class < 0)
+    {
+        return kmalloc(size, GFP_KERNEL);
+    }
+
+    return kmem_cache_alloc(aesd_entry_caches[size_class], GFP_KERNEL);
+}
+
+/**
+ * Frees @param buffptr, which must currently hold @param size bytes
+ */
+static void aesd_entry_free(const char *buffptr, size_t size)
+{
+    int size_class = aesd_entry_size_class(size);
+
+    if (buffptr == NULL)
+    {
+        return;
+    }
+
+    if (size_class < 0)
+    {
+        kfree(buffptr);
+    }
+    else
+    {
+        kmem_cache_free(aesd_entry_caches[size_class], (void *)buffptr);
+    }
+}
+
+static void aesd_entry_caches_destroy(void)
+{
+    for (int i = 0; i < ARRAY_SIZE(aesd_entry_caches); ++i)
+    {
+        // kmem_cache_destroy ignores NULL, so this also unwinds a partial create
+        kmem_cache_destroy(aesd_entry_caches[i]);
+        aesd_entry_caches[i] = NULL;
+    }
+}
+
+static int aesd_entry_caches_create(void)
+{
+    for (int i = 0; i < ARRAY_SIZE(aesd_entry_caches); ++i)
+    {
+        aesd_entry_caches[i] = kmem_cache_create(aesd_entry_cache_names[i], aesd_entry_size_classes[i], 0, 0, NULL);
+        if (aesd_entry_caches[i] == NULL)
+        {
+            aesd_entry_caches_destroy();
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static void aesd_record_mutex_wait(AesdDevice *device, u64 wait_ns)
+{
+    unsigned int bucket = min_t(unsigned int, fls64(wait_ns / NSEC_PER_USEC), AESD_MUTEX_WAIT_BUCKETS - 1);
+
+    this_cpu_inc(device->stats->mutex_contended);
+    this_cpu_inc(device->stats->mutex_wait[bucket]);
+}
+
+/**
+ * Locks device_mutex, recording the wait in the device statistics.  Uncontended acquisitions
+ * only cost a trylock and are counted in the first histogram bucket.
+ */
+static int aesd_device_lock_interruptible(AesdDevice *device)
+{
+    u64 start;
+
+    if (mutex_trylock(device->device_mutex))
+    {
+        this_cpu_inc(device->stats->mutex_wait[0]);
+        return 0;
+    }
+
+    start = ktime_get_ns();
+    if (mutex_lock_interruptible(device->device_mutex) != 0)
+    {
+        return -ERESTARTSYS;
+    }
+
+    aesd_record_mutex_wait(device, ktime_get_ns() - start);
+
+    return 0;
+}
+
+static void aesd_device_lock(AesdDevice *device)
+{
+    u64 start;
+
+    if (mutex_trylock(device->device_mutex))
+    {
+        this_cpu_inc(device->stats->mutex_wait[0]);
+        return;
+    }
+
+    start = ktime_get_ns();
+    mutex_lock(device->device_mutex);
+    aesd_record_mutex_wait(device, ktime_get_ns() - start);
+}
+
 int aesd_open(struct inode *inode, struct file *filp)
 {
-    AesdDevice *device;
+    AesdFile *file;
 
     PDEBUG("open\n");
 
-    device = container_of(inode->i_cdev, AesdDevice, cdev);
-    filp->private_data = device;
+    file = (AesdFile *)kmalloc(sizeof(AesdFile), GFP_KERNEL);
+    if (file == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    memset(file, 0, sizeof(AesdFile));
+    file->device = container_of(inode->i_cdev, AesdDevice, cdev);
+    mutex_init(&file->staging_mutex);
+    filp->private_data = file;
 
     return 0;
 }
 
+/**
+ * Moves the partial write staged in @param file to the device so the next committed entry
+ * completes it.  Must be called with device_mutex held.
+ */
+static void aesd_stash_partial(AesdDevice *device, AesdFile *file)
+{
+    unsigned long max_bytes = READ_ONCE(max_history_bytes);
+    char *partial;
+
+    if (device->current_write == NULL)
+    {
+        device->current_write = file->current_write;
+        device->current_write_len = file->current_write_len;
+        goto stashed;
+    }
+
+    if (max_bytes != 0 && device->current_write_len + file->current_write_len > max_bytes)
+    {
+        PDEBUG("dropping %zu byte partial write over the history limit\n", file->current_write_len);
+        aesd_entry_free(file->current_write, file->current_write_len);
+        goto stashed;
+    }
+
+    partial = aesd_entry_alloc(device->current_write_len + file->current_write_len);
+    if (partial == NULL)
+    {
+        PDEBUG("dropping %zu byte partial write\n", file->current_write_len);
+        aesd_entry_free(file->current_write, file->current_write_len);
+        goto stashed;
+    }
+
+    memcpy(partial, device->current_write, device->current_write_len);
+    memcpy(partial + device->current_write_len, file->current_write, file->current_write_len);
+    aesd_entry_free(device->current_write, device->current_write_len);
+    aesd_entry_free(file->current_write, file->current_write_len);
+    device->current_write = partial;
+    device->current_write_len += file->current_write_len;
+
+stashed:
+    file->current_write = NULL;
+    file->current_write_len = 0;
+}
+
+/**
+ * Prepends a partial write left behind by a closed file to @param entry, freeing both original
+ * buffers.  Must be called with device_mutex held.
+ */
+static void aesd_prepend_partial(AesdDevice *device, AesdBufferEntry *entry, unsigned long max_bytes)
+{
+    char *combined;
+
+    if (max_bytes != 0 && device->current_write_len + entry->size > max_bytes)
+    {
+        PDEBUG("dropping %zu byte partial write over the history limit\n", device->current_write_len);
+        aesd_entry_free(device->current_write, device->current_write_len);
+        device->current_write = NULL;
+        device->current_write_len = 0;
+        return;
+    }
+
+    combined = aesd_entry_alloc(device->current_write_len + entry->size);
+    if (combined == NULL)
+    {
+        // Leave the partial in place for the next commit
+        return;
+    }
+
+    memcpy(combined, device->current_write, device->current_write_len);
+    memcpy(combined + device->current_write_len, entry->buffptr, entry->size);
+    aesd_entry_free(entry->buffptr, entry->size);
+    aesd_entry_free(device->current_write, device->current_write_len);
+
+    entry->buffptr = combined;
+    entry->size += device->current_write_len;
+    device->current_write = NULL;
+    device->current_write_len = 0;
+}
+
 int aesd_release(struct inode *inode, struct file *filp)
 {
+    AesdFile *file = filp->private_data;
+    AesdDevice *device = file->device;
+
     PDEBUG("release\n");
 
+    // Partial writes outlive the file, matching the behavior of a single device-wide write buffer
+    if (file->current_write != NULL)
+    {
+        aesd_device_lock(device);
+        aesd_stash_partial(device, file);
+        mutex_unlock(device->device_mutex);
+    }
+
+    mutex_destroy(&file->staging_mutex);
+    kfree(file);
+
     return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                  loff_t *f_pos)
+/**
+ * Copies the entry most recently added to @param device's circular buffer into the mmap data ring
+ * and refreshes the header page.  Must be called with device_mutex held.
+ */
+static void aesd_mmap_publish(AesdDevice *device, const AesdBufferEntry *entry)
+{
+    AesdMmapHeader *header = (AesdMmapHeader *)device->mmap_area;
+    char *data = (char *)device->mmap_area + header->data_offset;
+    size_t entry_index = aesd_buffer_ring_slot(device->buffer, aesd_buffer_ring_count(device->buffer) - 1);
+    size_t skip = (entry->size > header->data_size) ? entry->size - header->data_size : 0;
+    size_t ring_pos = (header->data_head + skip) % header->data_size;
+    size_t first_len = min((size_t)(header->data_size - ring_pos), entry->size - skip);
+
+    WRITE_ONCE(header->sequence, header->sequence + 1);
+    smp_wmb();
+
+    // Entries larger than the ring only keep their tail, readers detect this from data_pos
+    memcpy(data + ring_pos, entry->buffptr + skip, first_len);
+    memcpy(data, entry->buffptr + skip + first_len, entry->size - skip - first_len);
+
+    header->entry[entry_index].data_pos = header->data_head;
+    header->entry[entry_index].size = entry->size;
+    header->data_head += entry->size;
+    header->in_offs = device->buffer->in_offs;
+    header->out_offs = device->buffer->out_offs;
+    header->full = device->buffer->full;
+
+    smp_wmb();
+    WRITE_ONCE(header->sequence, header->sequence + 1);
+}
+
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
     ssize_t bytes_read = 0;
-    size_t entry_offset = 0;
-    size_t str_len = 0;
-    size_t copy_len = 0;
+    size_t copied = 0;
+    size_t count = iov_iter_count(to);
+    size_t vec_count = 0;
+    unsigned long generation;
+    struct file *filp = iocb->ki_filp;
     AesdDevice *device;
-    AesdBufferEntry *entry;
+    AesdBufferVec vecs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
 
-    PDEBUG("read %zu bytes with offset %lld\n", count, *f_pos);
+    PDEBUG("read %zu bytes with offset %lld\n", count, iocb->ki_pos);
     if ((filp->f_flags & O_ACCMODE) == O_WRONLY)
     {
         return -EPERM;
     }
 
-    device = (AesdDevice *)filp->private_data;
+    device = ((AesdFile *)filp->private_data)->device;
 
-    if (mutex_lock_interruptible(device->device_mutex) != 0)
+    if (aesd_device_lock_interruptible(device) != 0)
     {
-        goto device_mutex_lock_failed;
+        return -ERESTARTSYS;
     }
 
-    entry = aesd_circular_buffer_find_entry_offset_for_fpos(device->buffer, *f_pos, &entry_offset);
-    if (entry == NULL)
+    vec_count = aesd_circular_buffer_export_range(device->buffer, iocb->ki_pos, count, vecs, ARRAY_SIZE(vecs), NULL);
+    while (vec_count == 0 && count != 0)
     {
-        goto close_function;
+        if (!follow_reads)
+        {
+            goto close_function;
+        }
+
+        if ((filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))
+        {
+            mutex_unlock(device->device_mutex);
+            return -EAGAIN;
+        }
+
+        // Sleep without the mutex until aesd_write_iter commits another entry
+        generation = device->generation;
+        mutex_unlock(device->device_mutex);
+        if (wait_event_interruptible(device->commit_queue, READ_ONCE(device->generation) != generation) != 0)
+        {
+            return -ERESTARTSYS;
+        }
+
+        if (aesd_device_lock_interruptible(device) != 0)
+        {
+            return -ERESTARTSYS;
+        }
+
+        vec_count = aesd_circular_buffer_export_range(device->buffer, iocb->ki_pos, count, vecs, ARRAY_SIZE(vecs), NULL);
     }
 
-    while (bytes_read < count)
+    // The exported range is already clipped to count, so only a faulting copy stops short
+    for (size_t i = 0; i < vec_count; ++i)
     {
-        str_len = entry->size - entry_offset;
-        copy_len = (count - bytes_read < str_len) ? count - bytes_read : str_len;
-        bytes_read += copy_len - copy_to_user(buf + bytes_read, entry->buffptr + entry_offset, copy_len);
-
-        entry_offset = 0;
-        entry = aesd_circular_buffer_next_entry(device->buffer, entry);
-        if (entry == NULL)
+        copied = copy_to_iter(vecs[i].iov_base, vecs[i].iov_len, to);
+        bytes_read += copied;
+        if (copied != vecs[i].iov_len)
         {
             goto close_function;
         }
     }
 
 close_function:
-    (*f_pos) += bytes_read;
+    iocb->ki_pos += bytes_read;
+    this_cpu_inc(device->stats->reads);
+    this_cpu_add(device->stats->read_bytes, bytes_read);
     mutex_unlock(device->device_mutex);
-device_mutex_lock_failed:
-    return bytes_read;
+
+    return (bytes_read == 0 && vec_count != 0) ? -EFAULT : bytes_read;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                   loff_t *f_pos)
+/**
+ * Commits @param entry to the history of @param device, prepending any orphaned partial write and
+ * evicting the oldest entries to keep within @param max_bytes, then wakes waiting readers.
+ * Takes device_mutex; the buffer of entry is owned by the history afterwards.
+ */
+static void aesd_commit_entry(AesdDevice *device, AesdBufferEntry entry, unsigned long max_bytes)
 {
+    AesdBufferEntry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1];
+    size_t evicted_count = 0;
+
+    // The commit is short and the data is already staged, so it must not be interrupted
+    aesd_device_lock(device);
+
+    if (device->current_write != NULL)
+    {
+        aesd_prepend_partial(device, &entry, max_bytes);
+    }
+
+    // aesd_write_iter rejects oversized records up front, but it scans user memory that can
+    // change before the copy, so the budget is enforced here whatever it let through
+    if (max_bytes != 0 && entry.size > max_bytes)
+    {
+        mutex_unlock(device->device_mutex);
+        PDEBUG("dropping %zu byte entry over the history limit\n", entry.size);
+        aesd_entry_free(entry.buffptr, entry.size);
+        return;
+    }
+
+    // Evict oldest entries until the new entry fits in the byte budget, freeing them once unlocked
+    while (max_bytes != 0 && aesd_circular_buffer_size(device->buffer) + entry.size > max_bytes &&
+           aesd_buffer_ring_pop(device->buffer, &evicted[evicted_count]))
+    {
+        ++evicted_count;
+    }
+
+    if (aesd_circular_buffer_push(device->buffer, &entry, &evicted[evicted_count]))
+    {
+        ++evicted_count;
+    }
+
+    aesd_mmap_publish(device, &entry);
+    device->generation++;
+
+    mutex_unlock(device->device_mutex);
+
+    // Wake after unlocking so readers do not immediately block on device_mutex
+    wake_up_interruptible(&device->commit_queue);
+    for (size_t i = 0; i < evicted_count; ++i)
+    {
+        this_cpu_add(device->stats->evicted_bytes, evicted[i].size);
+        aesd_entry_free(evicted[i].buffptr, evicted[i].size);
+    }
+
+    this_cpu_add(device->stats->evictions, evicted_count);
+}
+
+/**
+ * The longest record seen so far by aesd_record_scan
+ */
+typedef struct AesdRecordScan
+{
+    // Bytes of the record not yet terminated
+    size_t current;
+    // Bytes prepended to the first terminated record
+    size_t orphan;
+    size_t longest;
+} AesdRecordScan;
+
+/**
+ * Continues @param scan over the next @param length bytes of a write
+ */
+static void aesd_record_scan(AesdRecordScan *scan, const char *data, size_t length)
+{
+    size_t newline;
+
+    while ((newline = aesd_newline_find(data, length)) < length)
+    {
+        scan->current += scan->orphan + newline + 1;
+        scan->longest = max(scan->longest, scan->current);
+        scan->current = 0;
+        scan->orphan = 0;
+        data += newline + 1;
+        length -= newline + 1;
+    }
+
+    scan->current += length;
+}
+
+/**
+ * Finds the longest record @param from would commit without consuming it, the first record
+ * completing the @param staged_len bytes already staged and taking the @param orphan bytes of
+ * aesd_prepend_partial.  A final unterminated tail counts as a record, as it will become one.
+ * Stops early once a record exceeds @param max_bytes.
+ * @return the length of the longest record, or 0 if the user memory faulted, which the copy
+ *      that follows reports
+ */
+static size_t aesd_longest_record(const struct iov_iter *from, size_t staged_len, size_t orphan, size_t max_bytes)
+{
+    struct iov_iter peek = *from;
+    AesdRecordScan scan = {.current = staged_len, .orphan = orphan};
+    char chunk[256];
+    size_t length;
+
+    while (iov_iter_count(&peek) > 0 && max(scan.longest, scan.current) <= max_bytes)
+    {
+        length = min(iov_iter_count(&peek), sizeof(chunk));
+        if (!copy_from_iter_full(chunk, length, &peek))
+        {
+            return 0;
+        }
+
+        aesd_record_scan(&scan, chunk, length);
+    }
+
+    return max(scan.longest, scan.current);
+}
+
+/**
+ * Copies each newline terminated record in the @param staged_len bytes at @param staged into its
+ * own entry, the first record ending at @param first_newline.  Nothing is committed, so a failure
+ * leaves the staged write untouched.
+ * @param records_rtn is set to a kmalloc'd array of the records
+ * @param remainder_rtn and @param remainder_len_rtn are set to a new buffer holding the bytes after
+ *      the last newline, or NULL and 0 if the staged write ends in a newline
+ * @return the number of records, or -ENOMEM
+ */
+static long aesd_split_records(const char *staged, size_t staged_len, size_t first_newline,
+                               AesdBufferEntry **records_rtn, char **remainder_rtn, size_t *remainder_len_rtn)
+{
+    size_t record_count = 1 + aesd_newline_count(staged + first_newline + 1, staged_len - first_newline - 1);
+    AesdBufferEntry *records = kmalloc_array(record_count, sizeof(AesdBufferEntry), GFP_KERNEL);
+    size_t record_start = 0;
+    size_t record_end = first_newline;
+    size_t allocated = 0;
+    char *remainder = NULL;
+
+    if (records == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    for (; allocated < record_count; ++allocated)
+    {
+        records[allocated].size = record_end + 1 - record_start;
+        records[allocated].buffptr = aesd_entry_alloc(records[allocated].size);
+        if (records[allocated].buffptr == NULL)
+        {
+            goto record_alloc_failed;
+        }
+
+        memcpy((char *)records[allocated].buffptr, staged + record_start, records[allocated].size);
+        record_start = record_end + 1;
+        record_end = record_start + aesd_newline_find(staged + record_start, staged_len - record_start);
+    }
+
+    if (record_start < staged_len)
+    {
+        remainder = aesd_entry_alloc(staged_len - record_start);
+        if (remainder == NULL)
+        {
+            goto record_alloc_failed;
+        }
+
+        memcpy(remainder, staged + record_start, staged_len - record_start);
+    }
+
+    *records_rtn = records;
+    *remainder_rtn = remainder;
+    *remainder_len_rtn = staged_len - record_start;
+
+    return record_count;
+
+record_alloc_failed:
+    while (allocated-- > 0)
+    {
+        aesd_entry_free(records[allocated].buffptr, records[allocated].size);
+    }
+
+    kfree(records);
+
+    return -ENOMEM;
+}
+
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    size_t count = iov_iter_count(from);
     ssize_t retval = count;
+    struct file *filp = iocb->ki_filp;
+    unsigned long max_bytes = READ_ONCE(max_history_bytes);
+    AesdFile *file;
     AesdDevice *device;
-    const char *result;
-    AesdBufferEntry entry;
-
-    PDEBUG("write %zu bytes with offset %lld\n", count, *f_pos);
+    char *staging;
+    size_t staged_len;
+    size_t first_newline;
+    AesdBufferEntry single_record;
+    AesdBufferEntry *records = NULL;
+    long record_count = 0;
+    char *remainder = NULL;
+    size_t remainder_len = 0;
+
+    PDEBUG("write %zu bytes with offset %lld\n", count, iocb->ki_pos);
     if ((filp->f_flags & O_ACCMODE) == O_RDONLY)
     {
         return -EPERM;
     }
 
-    device = filp->private_data;
+    if (count == 0)
+    {
+        return 0;
+    }
 
-    if (mutex_lock_interruptible(device->device_mutex) != 0)
+    file = filp->private_data;
+    device = file->device;
+
+    if (mutex_lock_interruptible(&file->staging_mutex) != 0)
     {
         retval = -ERESTARTSYS;
-        goto device_mutex_lock_failed;
+        goto staging_mutex_lock_failed;
     }
 
-    if (device->current_write != NULL)
+    // Records are committed on their own, so a write larger than the history limit is only
+    // rejected for a record that could never fit, before staging all of it.  Scanning user
+    // memory twice is left to writes that large.
+    staged_len = file->current_write_len + count;
+    if (max_bytes != 0 && staged_len + READ_ONCE(device->current_write_len) > max_bytes &&
+        aesd_longest_record(from, file->current_write_len, READ_ONCE(device->current_write_len), max_bytes) > max_bytes)
     {
-        char *temp_write = kmalloc_array(device->current_write_len + count, sizeof(char), GFP_KERNEL);
-        if (temp_write == NULL)
+        retval = -EFBIG;
+        goto str_malloc_failed;
+    }
+
+    // Append in place while the staged write stays within its size class
+    staging = file->current_write;
+    if (staging == NULL || staged_len > aesd_entry_capacity(file->current_write_len))
+    {
+        staging = aesd_entry_alloc(staged_len);
+        if (staging == NULL)
         {
             retval = -ENOMEM;
             goto str_malloc_failed;
         }
+    }
 
-        memset(temp_write, 0, device->current_write_len + count);
+    // All or nothing, so the staged length always matches the size class of its buffer
+    if (!copy_from_iter_full(staging + file->current_write_len, count, from))
+    {
+        retval = -EFAULT;
+        goto split_failed;
+    }
 
-        memcpy(temp_write, device->current_write, device->current_write_len);
-        retval -= copy_from_user(temp_write + device->current_write_len, buf, count);
-        kfree(device->current_write);
-        device->current_write = temp_write;
-        device->current_write_len += count;
+    if (staging != file->current_write)
+    {
+        memcpy(staging, file->current_write, file->current_write_len);
     }
-    else
+
+    // Only the new bytes can hold a newline, anything already staged was scanned by earlier writes
+    first_newline = file->current_write_len + aesd_newline_find(staging + file->current_write_len, count);
+
+    if (first_newline == staged_len - 1)
+    {
+        single_record = (AesdBufferEntry){
+            .buffptr = staging,
+            .size = staged_len,
+        };
+        records = &single_record;
+        record_count = 1;
+    }
+    else if (first_newline < staged_len)
     {
-        device->current_write = kmalloc_array(count, sizeof(char), GFP_KERNEL);
-        if (device->current_write == NULL)
+        record_count = aesd_split_records(staging, staged_len, first_newline, &records, &remainder, &remainder_len);
+        if (record_count < 0)
         {
-            retval = -ENOMEM;
-            goto str_malloc_failed;
+            retval = record_count;
+            goto split_failed;
         }
+    }
 
-        memset(device->current_write, 0, count);
+    if (staging != file->current_write)
+    {
+        if (file->current_write != NULL)
+        {
+            this_cpu_inc(device->stats->partial_reallocs);
+        }
 
-        retval -= copy_from_user(device->current_write, buf, count);
-        device->current_write_len = count;
+        aesd_entry_free(file->current_write, file->current_write_len);
     }
 
-    if (device->current_write[device->current_write_len - 1] == '\n')
+    // Records own their buffers now, only the bytes after the last newline stay staged
+    if (records != NULL && records != &single_record)
     {
-        entry = (AesdBufferEntry){
-            .buffptr = device->current_write,
-            .size = device->current_write_len,
-        };
+        aesd_entry_free(staging, staged_len);
+        staging = remainder;
+        staged_len = remainder_len;
+    }
+    else if (records == &single_record)
+    {
+        staging = NULL;
+        staged_len = 0;
+    }
 
-        result = aesd_circular_buffer_add_entry(device->buffer, &entry);
-        device->current_write = NULL;
-        device->current_write_len = 0;
-        if (result != NULL)
-        {
-            kfree(result);
-            result = NULL;
-        }
+    file->current_write = staging;
+    file->current_write_len = staged_len;
+
+    for (long i = 0; i < record_count; ++i)
+    {
+        aesd_commit_entry(device, records[i], max_bytes);
+    }
+
+    if (records != &single_record)
+    {
+        kfree(records);
     }
 
-    (*f_pos) += retval;
+    this_cpu_inc(device->stats->writes);
+    this_cpu_add(device->stats->write_bytes, retval);
+    iocb->ki_pos += retval;
+
+    // Once committed staging is the staged write, so this only frees a buffer a failed write allocated
+split_failed:
+    if (staging != file->current_write)
+    {
+        aesd_entry_free(staging, staged_len);
+    }
 str_malloc_failed:
-    mutex_unlock(device->device_mutex);
-device_mutex_lock_failed:
+    mutex_unlock(&file->staging_mutex);
+staging_mutex_lock_failed:
     return retval;
 }
 
@@ -188,8 +754,8 @@ loff_t aesd_seek(struct file *filp, loff_t f_pos, int whence)
 
     PDEBUG("Seek to position %lld from location %d\n", f_pos, whence);
 
-    device = filp->private_data;
-    if (mutex_lock_interruptible(device->device_mutex) != 0)
+    device = ((AesdFile *)filp->private_data)->device;
+    if (aesd_device_lock_interruptible(device) != 0)
     {
         return -ERESTARTSYS;
     }
@@ -198,80 +764,359 @@ loff_t aesd_seek(struct file *filp, loff_t f_pos, int whence)
 
     mutex_unlock(device->device_mutex);
 
+    this_cpu_inc(device->stats->seeks);
+
     return fixed_size_llseek(filp, f_pos, whence, file_size);
 }
 
+/**
+ * Converts the zero referenced @param command and @param command_offset into a byte position in
+ * the concatenated history of @param buffer.  Must be called with device_mutex held.
+ * @return the position, or -EINVAL if the command or offset is not in the buffer
+ */
+static long aesd_command_position(AesdCircularBuffer *buffer, uint32_t command, uint32_t command_offset)
+{
+    long position = 0;
+    AesdBufferEntry *entry = aesd_buffer_ring_get(buffer, command);
+
+    if (entry == NULL || command_offset >= entry->size)
+    {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < command; ++i)
+    {
+        position += aesd_buffer_ring_get(buffer, i)->size;
+    }
+
+    return position + command_offset;
+}
+
 long aesd_adjust_file_offset(struct file *filp, uint32_t command, uint32_t command_offset)
 {
     AesdDevice *device;
     long position = 0;
-    size_t index = 0;
-    size_t command_index = 0;
+    size_t file_size;
 
     PDEBUG("Seeking to position %u within command %u\n", command_offset, command);
 
-    device = filp->private_data;
-    if (mutex_lock_interruptible(device->device_mutex) != 0)
+    device = ((AesdFile *)filp->private_data)->device;
+    if (aesd_device_lock_interruptible(device) != 0)
     {
         return -ERESTARTSYS;
     }
 
-    if ((device->buffer->in_offs == device->buffer->out_offs && !device->buffer->full) || command >= 10)
+    position = aesd_command_position(device->buffer, command, command_offset);
+    file_size = aesd_circular_buffer_size(device->buffer);
+
+    mutex_unlock(device->device_mutex);
+
+    if (position < 0)
     {
-        position = -EINVAL;
-        goto early_return;
+        return position;
     }
 
-    for (size_t i = 0; i < command; ++i)
+    return fixed_size_llseek(filp, position, SEEK_SET, file_size);
+}
+
+long aesd_history_info(struct file *filp, AesdHistoryInfo *history_info)
+{
+    AesdDevice *device;
+    AesdEntryInfo entries[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    AesdBufferEntry *entry;
+    size_t copy_count;
+
+    PDEBUG("Reading history info for %u entries\n", history_info->entries_len);
+
+    device = ((AesdFile *)filp->private_data)->device;
+    if (aesd_device_lock_interruptible(device) != 0)
     {
-        index = (i + device->buffer->out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        return -ERESTARTSYS;
+    }
 
-        position += device->buffer->entry[index].size;
+    history_info->entry_count = aesd_circular_buffer_entry_count(device->buffer);
+    history_info->total_size = 0;
+    history_info->generation = device->generation;
+    for (size_t i = 0; i < history_info->entry_count; ++i)
+    {
+        entry = aesd_buffer_ring_get(device->buffer, i);
+        entries[i].offset = history_info->total_size;
+        entries[i].size = entry->size;
+        history_info->total_size += entry->size;
     }
 
-    command_index = (command + device->buffer->out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    if (command_offset >= device->buffer->entry[command_index].size)
+    mutex_unlock(device->device_mutex);
+
+    // Copy from the snapshot so user space faults are not taken with device_mutex held
+    copy_count = min((size_t)history_info->entries_len, (size_t)history_info->entry_count);
+    if (copy_to_user(u64_to_user_ptr(history_info->entries), entries, copy_count * sizeof(AesdEntryInfo)) != 0)
     {
-        position = -EINVAL;
+        return -EFAULT;
     }
-    else
+
+    return 0;
+}
+
+long aesd_read_commands(struct file *filp, AesdReadCommands *read_commands)
+{
+    AesdDevice *device;
+    AesdBufferEntry *entry;
+    AesdBufferVec vecs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t vec_count;
+    size_t length = 0;
+    size_t copied = 0;
+    long position;
+    char *bounce = NULL;
+
+    PDEBUG("Reading %u commands from command %u\n", read_commands->cmd_count, read_commands->first_cmd);
+
+    device = ((AesdFile *)filp->private_data)->device;
+    if (aesd_device_lock_interruptible(device) != 0)
+    {
+        return -ERESTARTSYS;
+    }
+
+    read_commands->bytes_read = 0;
+    read_commands->generation = device->generation;
+
+    position = aesd_command_position(device->buffer, read_commands->first_cmd, 0);
+    if (position < 0)
+    {
+        mutex_unlock(device->device_mutex);
+        return position;
+    }
+
+    entry = aesd_buffer_ring_get(device->buffer, read_commands->first_cmd);
+    for (uint32_t i = 0; i < read_commands->cmd_count && entry != NULL; ++i)
+    {
+        length += entry->size;
+        entry = aesd_circular_buffer_next_entry(device->buffer, entry);
+    }
+
+    length = min(length, (size_t)read_commands->buffer_len);
+    vec_count = aesd_circular_buffer_export_range(device->buffer, position, length, vecs, ARRAY_SIZE(vecs), &length);
+
+    // Entries can be evicted and freed once unlocked, so they are copied to a bounce buffer and
+    // the user space copy, which may fault, happens without device_mutex held
+    if (length != 0)
+    {
+        bounce = kvmalloc(length, GFP_KERNEL);
+        if (bounce == NULL)
+        {
+            mutex_unlock(device->device_mutex);
+            return -ENOMEM;
+        }
+
+        for (size_t i = 0; i < vec_count; ++i)
+        {
+            memcpy(bounce + copied, vecs[i].iov_base, vecs[i].iov_len);
+            copied += vecs[i].iov_len;
+        }
+    }
+
+    mutex_unlock(device->device_mutex);
+
+    read_commands->bytes_read = length - copy_to_user(u64_to_user_ptr(read_commands->buffer), bounce, length);
+    kvfree(bounce);
+    if (read_commands->bytes_read != length)
     {
-        position += command_offset;
+        return -EFAULT;
     }
 
-early_return:
+    // The data has reached user space, so the position must follow it even if a signal is pending
+    aesd_device_lock(device);
+    filp->f_pos = position + length;
     mutex_unlock(device->device_mutex);
 
-    return aesd_seek(filp, position, SEEK_SET);
+    return 0;
 }
 
 long aesd_ioctl(struct file *filp, unsigned int command, unsigned long arg)
 {
+    long retval;
+
+    this_cpu_inc(((AesdFile *)filp->private_data)->device->stats->ioctls);
+
     switch (command)
     {
     case AESDCHAR_IOCSEEKTO:
+    {
         AesdSeekTo seek_to = {0};
         if (copy_from_user(&seek_to, (const void __user *)arg, sizeof(AesdSeekTo)) != 0)
         {
-            return EFAULT;
+            return -EFAULT;
+        }
+
+        return aesd_adjust_file_offset(filp, seek_to.write_cmd, seek_to.write_cmd_offset);
+    }
+    case AESDCHAR_IOCGHISTORY:
+    {
+        AesdHistoryInfo history_info = {0};
+        if (copy_from_user(&history_info, (const void __user *)arg, sizeof(AesdHistoryInfo)) != 0)
+        {
+            return -EFAULT;
+        }
+
+        retval = aesd_history_info(filp, &history_info);
+        if (retval == 0 && copy_to_user((void __user *)arg, &history_info, sizeof(AesdHistoryInfo)) != 0)
+        {
+            return -EFAULT;
+        }
+
+        return retval;
+    }
+    case AESDCHAR_IOCREADCMDS:
+    {
+        AesdReadCommands read_commands = {0};
+        if (copy_from_user(&read_commands, (const void __user *)arg, sizeof(AesdReadCommands)) != 0)
+        {
+            return -EFAULT;
         }
-        else
+
+        retval = aesd_read_commands(filp, &read_commands);
+        if (retval == 0 && copy_to_user((void __user *)arg, &read_commands, sizeof(AesdReadCommands)) != 0)
         {
-            return aesd_adjust_file_offset(filp, seek_to.write_cmd, seek_to.write_cmd_offset);
+            return -EFAULT;
         }
+
+        return retval;
+    }
     default:
-        return ENOTSUPP;
+        return -ENOTTY;
     }
 }
 
+__poll_t aesd_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    AesdDevice *device;
+    __poll_t mask = 0;
+    size_t entry_offset = 0;
+
+    device = ((AesdFile *)filp->private_data)->device;
+
+    poll_wait(filp, &device->commit_queue, wait);
+
+    if ((filp->f_flags & O_ACCMODE) != O_RDONLY)
+    {
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    }
+
+    // ->poll cannot be restarted, so a signal must not turn into a spurious error
+    aesd_device_lock(device);
+
+    if (aesd_circular_buffer_find_entry_offset_for_fpos(device->buffer, filp->f_pos, &entry_offset) != NULL)
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+
+    mutex_unlock(device->device_mutex);
+
+    return mask;
+}
+
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    AesdDevice *device;
+
+    PDEBUG("mmap %lu bytes at page %lu\n", vma->vm_end - vma->vm_start, vma->vm_pgoff);
+
+    // The history is only exported for reading, writes must go through aesd_write_iter
+    if (vma->vm_flags & VM_WRITE)
+    {
+        return -EPERM;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    device = ((AesdFile *)filp->private_data)->device;
+
+    return remap_vmalloc_range(vma, device->mmap_area, vma->vm_pgoff);
+}
+
+static int aesd_stats_show(struct seq_file *seq, void *unused)
+{
+    AesdDevice *device = seq->private;
+    AesdStats total = {0};
+    AesdStats *cpu_stats;
+    size_t history_bytes;
+    size_t history_entries;
+    size_t partial_bytes;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        cpu_stats = per_cpu_ptr(device->stats, cpu);
+        total.reads += cpu_stats->reads;
+        total.read_bytes += cpu_stats->read_bytes;
+        total.writes += cpu_stats->writes;
+        total.write_bytes += cpu_stats->write_bytes;
+        total.seeks += cpu_stats->seeks;
+        total.ioctls += cpu_stats->ioctls;
+        total.evictions += cpu_stats->evictions;
+        total.evicted_bytes += cpu_stats->evicted_bytes;
+        total.partial_reallocs += cpu_stats->partial_reallocs;
+        total.mutex_contended += cpu_stats->mutex_contended;
+        for (int i = 0; i < AESD_MUTEX_WAIT_BUCKETS; ++i)
+        {
+            total.mutex_wait[i] += cpu_stats->mutex_wait[i];
+        }
+    }
+
+    // Read the footprint without aesd_device_lock so reading the statistics does not skew them
+    if (mutex_lock_interruptible(device->device_mutex) != 0)
+    {
+        return -ERESTARTSYS;
+    }
+
+    history_bytes = aesd_circular_buffer_size(device->buffer);
+    history_entries = aesd_circular_buffer_entry_count(device->buffer);
+    partial_bytes = device->current_write_len;
+
+    mutex_unlock(device->device_mutex);
+
+    seq_printf(seq, "reads: %llu\n", total.reads);
+    seq_printf(seq, "read_bytes: %llu\n", total.read_bytes);
+    seq_printf(seq, "writes: %llu\n", total.writes);
+    seq_printf(seq, "write_bytes: %llu\n", total.write_bytes);
+    seq_printf(seq, "seeks: %llu\n", total.seeks);
+    seq_printf(seq, "ioctls: %llu\n", total.ioctls);
+    seq_printf(seq, "evictions: %llu\n", total.evictions);
+    seq_printf(seq, "evicted_bytes: %llu\n", total.evicted_bytes);
+    seq_printf(seq, "partial_reallocs: %llu\n", total.partial_reallocs);
+    seq_printf(seq, "history_entries: %zu\n", history_entries);
+    seq_printf(seq, "history_bytes: %zu\n", history_bytes);
+    seq_printf(seq, "orphaned_partial_bytes: %zu\n", partial_bytes);
+    seq_printf(seq, "mutex_contended: %llu\n", total.mutex_contended);
+    seq_puts(seq, "mutex_wait_us:\n");
+    for (int i = 0; i < AESD_MUTEX_WAIT_BUCKETS; ++i)
+    {
+        seq_printf(seq, "  <%u: %llu\n", 1U << i, total.mutex_wait[i]);
+    }
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
 struct file_operations aesd_fops = {
     .owner = THIS_MODULE,
-    .read = aesd_read,
-    .write = aesd_write,
+    .read_iter = aesd_read_iter,
+    .write_iter = aesd_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
+    .splice_write = iter_file_splice_write,
     .open = aesd_open,
     .release = aesd_release,
     .llseek = aesd_seek,
     .unlocked_ioctl = aesd_ioctl,
+    .poll = aesd_poll,
+    .mmap = aesd_mmap,
 };
 
 static int aesd_setup_cdev(AesdDevice *dev)
@@ -304,10 +1149,16 @@ int aesd_init_module(void)
 
     memset(&aesd_device, 0, sizeof(AesdDevice));
 
+    result = aesd_entry_caches_create();
+    if (result)
+    {
+        goto entry_caches_create_failed;
+    }
+
     aesd_device.buffer = (AesdCircularBuffer *)kmalloc(sizeof(AesdCircularBuffer), GFP_KERNEL);
     if (aesd_device.buffer == NULL)
     {
-        result = ENOMEM;
+        result = -ENOMEM;
         goto buffer_malloc_failed;
     }
 
@@ -316,12 +1167,35 @@ int aesd_init_module(void)
     aesd_device.device_mutex = (struct mutex *)kmalloc(sizeof(struct mutex), GFP_KERNEL);
     if (aesd_device.device_mutex == NULL)
     {
-        result = ENOMEM;
+        result = -ENOMEM;
         goto device_mutex_malloc_failed;
     }
 
     memset(aesd_device.device_mutex, 0, sizeof(struct mutex));
     mutex_init(aesd_device.device_mutex);
+    init_waitqueue_head(&aesd_device.commit_queue);
+
+    aesd_device.stats = alloc_percpu(AesdStats);
+    if (aesd_device.stats == NULL)
+    {
+        result = -ENOMEM;
+        goto stats_malloc_failed;
+    }
+
+    // vmalloc_user returns zeroed memory suitable for remap_vmalloc_range
+    aesd_device.mmap_area = vmalloc_user(PAGE_SIZE + AESDCHAR_MMAP_DATA_SIZE);
+    if (aesd_device.mmap_area == NULL)
+    {
+        result = -ENOMEM;
+        goto mmap_area_malloc_failed;
+    }
+
+    ((AesdMmapHeader *)aesd_device.mmap_area)->data_offset = PAGE_SIZE;
+    ((AesdMmapHeader *)aesd_device.mmap_area)->data_size = AESDCHAR_MMAP_DATA_SIZE;
+
+    // debugfs failures are not fatal, the driver works without its statistics file
+    aesd_device.debugfs_dir = debugfs_create_dir("aesdchar", NULL);
+    debugfs_create_file("stats", 0444, aesd_device.debugfs_dir, &aesd_device, &aesd_stats_fops);
 
     result = aesd_setup_cdev(&aesd_device);
 
@@ -333,10 +1207,18 @@ int aesd_init_module(void)
     return 0;
 
 setup_cdev_failed:
+    debugfs_remove_recursive(aesd_device.debugfs_dir);
+    vfree(aesd_device.mmap_area);
+mmap_area_malloc_failed:
+    free_percpu(aesd_device.stats);
+stats_malloc_failed:
+    mutex_destroy(aesd_device.device_mutex);
     kfree(aesd_device.device_mutex);
 device_mutex_malloc_failed:
     kfree(aesd_device.buffer);
 buffer_malloc_failed:
+    aesd_entry_caches_destroy();
+entry_caches_create_failed:
     unregister_chrdev_region(dev, 1);
 alloc_chrdev_failed:
     return result;
@@ -345,22 +1227,38 @@ alloc_chrdev_failed:
 void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
+    AesdBufferEntry *entry;
+    uint8_t index;
 
     cdev_del(&aesd_device.cdev);
 
+    debugfs_remove_recursive(aesd_device.debugfs_dir);
+
+    // Clearing does not free entries, they go back to their size class cache here
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, aesd_device.buffer, index)
+    {
+        aesd_entry_free(entry->buffptr, entry->size);
+        entry->buffptr = NULL;
+    }
+
     aesd_circular_buffer_clear(aesd_device.buffer);
     kfree(aesd_device.buffer);
 
     mutex_destroy(aesd_device.device_mutex);
     kfree(aesd_device.device_mutex);
 
+    vfree(aesd_device.mmap_area);
+    free_percpu(aesd_device.stats);
+
     if (aesd_device.current_write != NULL)
     {
-        kfree(aesd_device.current_write);
+        aesd_entry_free(aesd_device.current_write, aesd_device.current_write_len);
         aesd_device.current_write = NULL;
         aesd_device.current_write_len = 0;
     }
 
+    aesd_entry_caches_destroy();
+
     unregister_chrdev_region(devno, 1);
 }
 
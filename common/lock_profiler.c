@@ -0,0 +1,393 @@
+#ifdef LOCK_PROFILE
+
+#include "lock_profiler.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOCK_PROFILER_MAX_MUTEXES 64
+#define LOCK_PROFILER_MAX_SITES 16
+#define LOCK_PROFILER_REPORTED_SITES 5
+// Bucket n counts durations of n significant bits, the last bucket everything from ~0.5s up
+#define LOCK_PROFILER_HISTOGRAM_BUCKETS 30
+
+typedef struct LockHistogram
+{
+    atomic_uint_fast64_t bucket[LOCK_PROFILER_HISTOGRAM_BUCKETS];
+    atomic_uint_fast64_t total_ns;
+    atomic_uint_fast64_t max_ns;
+} LockHistogram;
+
+typedef struct LockSite
+{
+    _Atomic(const char *) file;
+    atomic_int line;
+    atomic_uint_fast64_t holds;
+    atomic_uint_fast64_t hold_ns;
+    atomic_uint_fast64_t max_hold_ns;
+} LockSite;
+
+typedef struct LockProfile
+{
+    _Atomic(pthread_mutex_t *) mutex;
+    _Atomic(const char *) name;
+
+    atomic_uint_fast64_t acquisitions;
+    atomic_uint_fast64_t contended;
+    LockHistogram wait;
+    LockHistogram hold;
+    LockSite sites[LOCK_PROFILER_MAX_SITES];
+    atomic_uint_fast64_t untracked_site_holds;
+
+    /**
+     * The current hold, only touched by the thread holding the mutex
+     */
+    uint64_t acquired_ns;
+    LockSite *holder_site;
+} LockProfile;
+
+static LockProfile profiles[LOCK_PROFILER_MAX_MUTEXES];
+static atomic_uint_fast64_t untracked_mutex_acquisitions;
+
+static pthread_once_t install_once = PTHREAD_ONCE_INIT;
+static volatile sig_atomic_t report_requested = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Statistics are only updated by the thread holding the profiled mutex, so the updates need no
+ * read-modify-write; they are atomic only so a concurrent report reads whole values.
+ */
+static void counter_add(atomic_uint_fast64_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static void counter_max(atomic_uint_fast64_t *counter, uint64_t value)
+{
+    if (value > atomic_load_explicit(counter, memory_order_relaxed))
+    {
+        atomic_store_explicit(counter, value, memory_order_relaxed);
+    }
+}
+
+static void histogram_record(LockHistogram *histogram, uint64_t ns)
+{
+    size_t bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+
+    if (bucket >= LOCK_PROFILER_HISTOGRAM_BUCKETS)
+    {
+        bucket = LOCK_PROFILER_HISTOGRAM_BUCKETS - 1;
+    }
+
+    counter_add(&histogram->bucket[bucket], 1);
+    counter_add(&histogram->total_ns, ns);
+    counter_max(&histogram->max_ns, ns);
+}
+
+static void handle_report_signal(int signal)
+{
+    (void)signal;
+    report_requested = 1;
+}
+
+static void report_at_exit(void)
+{
+    lock_profiler_report(stderr);
+}
+
+/**
+ * Hooks up the report on the first profiled lock.  An application that already handles SIGUSR1
+ * keeps its handler.
+ */
+static void install_reporting(void)
+{
+    struct sigaction current;
+
+    atexit(report_at_exit);
+    if (sigaction(SIGUSR1, NULL, &current) == 0 && current.sa_handler == SIG_DFL)
+    {
+        struct sigaction report_handler = {
+            .sa_handler = handle_report_signal,
+            .sa_flags = SA_RESTART,
+        };
+
+        sigemptyset(&report_handler.sa_mask);
+        sigaction(SIGUSR1, &report_handler, NULL);
+    }
+}
+
+/**
+ * @return the profile of @param mutex, claiming a free one named @param name if it has none, or
+ *      NULL once every profile is claimed.  Without a name nothing is claimed.
+ */
+static LockProfile *find_profile(pthread_mutex_t *mutex, const char *name)
+{
+    size_t start = ((uintptr_t)mutex >> 4) % LOCK_PROFILER_MAX_MUTEXES;
+
+    for (size_t i = 0; i < LOCK_PROFILER_MAX_MUTEXES; ++i)
+    {
+        LockProfile *profile = &profiles[(start + i) % LOCK_PROFILER_MAX_MUTEXES];
+        pthread_mutex_t *owner = atomic_load_explicit(&profile->mutex, memory_order_acquire);
+
+        if (owner == NULL)
+        {
+            if (name == NULL)
+            {
+                return NULL;
+            }
+
+            if (!atomic_compare_exchange_strong(&profile->mutex, &owner, mutex) && owner != mutex)
+            {
+                continue;
+            }
+
+            if (owner == NULL)
+            {
+                const char *unnamed = NULL;
+
+                atomic_compare_exchange_strong(&profile->name, &unnamed, name);
+                pthread_once(&install_once, install_reporting);
+            }
+
+            return profile;
+        }
+
+        if (owner == mutex)
+        {
+            return profile;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Called with the mutex held, so sites of one profile are never claimed concurrently
+ */
+static LockSite *find_site(LockProfile *profile, const char *file, int line)
+{
+    for (size_t i = 0; i < LOCK_PROFILER_MAX_SITES; ++i)
+    {
+        LockSite *site = &profile->sites[i];
+        const char *site_file = atomic_load_explicit(&site->file, memory_order_relaxed);
+
+        if (site_file == NULL)
+        {
+            atomic_store_explicit(&site->line, line, memory_order_relaxed);
+            atomic_store_explicit(&site->file, file, memory_order_release);
+            return site;
+        }
+
+        if (atomic_load_explicit(&site->line, memory_order_relaxed) == line && strcmp(site_file, file) == 0)
+        {
+            return site;
+        }
+    }
+
+    return NULL;
+}
+
+int lock_profiler_lock(pthread_mutex_t *mutex, const char *name, const char *file, int line)
+{
+    LockProfile *profile = find_profile(mutex, name);
+    uint64_t start;
+    bool contended = false;
+    int result;
+
+    if (profile == NULL)
+    {
+        atomic_fetch_add_explicit(&untracked_mutex_acquisitions, 1, memory_order_relaxed);
+        return pthread_mutex_lock(mutex);
+    }
+
+    start = now_ns();
+    result = pthread_mutex_trylock(mutex);
+    if (result == EBUSY)
+    {
+        contended = true;
+        result = pthread_mutex_lock(mutex);
+    }
+
+    if (result != 0)
+    {
+        return result;
+    }
+
+    profile->acquired_ns = now_ns();
+    profile->holder_site = find_site(profile, file, line);
+
+    counter_add(&profile->acquisitions, 1);
+    if (contended)
+    {
+        counter_add(&profile->contended, 1);
+    }
+
+    histogram_record(&profile->wait, profile->acquired_ns - start);
+
+    return 0;
+}
+
+int lock_profiler_unlock(pthread_mutex_t *mutex)
+{
+    LockProfile *profile = find_profile(mutex, NULL);
+    int result;
+
+    if (profile != NULL && profile->acquired_ns != 0)
+    {
+        uint64_t held = now_ns() - profile->acquired_ns;
+        LockSite *site = profile->holder_site;
+
+        histogram_record(&profile->hold, held);
+        if (site != NULL)
+        {
+            counter_add(&site->holds, 1);
+            counter_add(&site->hold_ns, held);
+            counter_max(&site->max_hold_ns, held);
+        }
+        else
+        {
+            counter_add(&profile->untracked_site_holds, 1);
+        }
+
+        profile->acquired_ns = 0;
+        profile->holder_site = NULL;
+    }
+
+    result = pthread_mutex_unlock(mutex);
+    if (report_requested)
+    {
+        report_requested = 0;
+        lock_profiler_report(stderr);
+    }
+
+    return result;
+}
+
+void lock_profiler_name(pthread_mutex_t *mutex, const char *name)
+{
+    LockProfile *profile = find_profile(mutex, name);
+
+    if (profile != NULL)
+    {
+        atomic_store(&profile->name, name);
+    }
+}
+
+static void report_histogram(FILE *stream, const char *label, LockHistogram *histogram)
+{
+    fprintf(stream, "  %s: total %.3f ms, max %.3f ms\n", label,
+            atomic_load_explicit(&histogram->total_ns, memory_order_relaxed) / 1e6,
+            atomic_load_explicit(&histogram->max_ns, memory_order_relaxed) / 1e6);
+
+    for (size_t i = 0; i < LOCK_PROFILER_HISTOGRAM_BUCKETS; ++i)
+    {
+        uint64_t count = atomic_load_explicit(&histogram->bucket[i], memory_order_relaxed);
+        uint64_t low = (i == 0) ? 0 : 1ULL << (i - 1);
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        if (i == LOCK_PROFILER_HISTOGRAM_BUCKETS - 1)
+        {
+            fprintf(stream, "    %12" PRIu64 " ns and up    %10" PRIu64 "\n", low, count);
+        }
+        else
+        {
+            fprintf(stream, "    %12" PRIu64 " - %12" PRIu64 " ns %10" PRIu64 "\n", low, (uint64_t)((i == 0) ? 0 : (1ULL << i) - 1), count);
+        }
+    }
+}
+
+static int compare_site_hold(const void *a, const void *b)
+{
+    uint64_t a_ns = atomic_load_explicit(&(*(LockSite *const *)a)->hold_ns, memory_order_relaxed);
+    uint64_t b_ns = atomic_load_explicit(&(*(LockSite *const *)b)->hold_ns, memory_order_relaxed);
+
+    return (a_ns < b_ns) - (a_ns > b_ns);
+}
+
+void lock_profiler_report(FILE *stream)
+{
+    fprintf(stream, "lock profile of process %d\n", (int)getpid());
+
+    for (size_t i = 0; i < LOCK_PROFILER_MAX_MUTEXES; ++i)
+    {
+        LockProfile *profile = &profiles[i];
+        pthread_mutex_t *mutex = atomic_load_explicit(&profile->mutex, memory_order_acquire);
+        LockSite *sites[LOCK_PROFILER_MAX_SITES];
+        size_t site_count = 0;
+        uint64_t acquisitions;
+        uint64_t contended;
+
+        if (mutex == NULL)
+        {
+            continue;
+        }
+
+        acquisitions = atomic_load_explicit(&profile->acquisitions, memory_order_relaxed);
+        contended = atomic_load_explicit(&profile->contended, memory_order_relaxed);
+        fprintf(stream, "%s (%p): %" PRIu64 " acquisitions, %" PRIu64 " contended (%.1f%%)\n",
+                atomic_load(&profile->name), (void *)mutex, acquisitions, contended,
+                (acquisitions == 0) ? 0.0 : 100.0 * contended / acquisitions);
+
+        report_histogram(stream, "wait", &profile->wait);
+        report_histogram(stream, "hold", &profile->hold);
+
+        for (; site_count < LOCK_PROFILER_MAX_SITES; ++site_count)
+        {
+            if (atomic_load_explicit(&profile->sites[site_count].file, memory_order_acquire) == NULL)
+            {
+                break;
+            }
+
+            sites[site_count] = &profile->sites[site_count];
+        }
+
+        qsort(sites, site_count, sizeof(sites[0]), compare_site_hold);
+        fprintf(stream, "  longest holding sites:\n");
+        for (size_t s = 0; s < site_count && s < LOCK_PROFILER_REPORTED_SITES; ++s)
+        {
+            uint64_t holds = atomic_load_explicit(&sites[s]->holds, memory_order_relaxed);
+            uint64_t hold_ns = atomic_load_explicit(&sites[s]->hold_ns, memory_order_relaxed);
+
+            fprintf(stream, "    %s:%d  %" PRIu64 " holds, total %.3f ms, mean %.3f ms, max %.3f ms\n",
+                    atomic_load(&sites[s]->file), atomic_load(&sites[s]->line), holds, hold_ns / 1e6,
+                    (holds == 0) ? 0.0 : hold_ns / 1e6 / holds,
+                    atomic_load_explicit(&sites[s]->max_hold_ns, memory_order_relaxed) / 1e6);
+        }
+
+        if (atomic_load(&profile->untracked_site_holds) != 0)
+        {
+            fprintf(stream, "    %" PRIu64 " holds from sites past the first %d\n",
+                    atomic_load(&profile->untracked_site_holds), LOCK_PROFILER_MAX_SITES);
+        }
+    }
+
+    if (atomic_load(&untracked_mutex_acquisitions) != 0)
+    {
+        fprintf(stream, "%" PRIu64 " acquisitions of mutexes past the first %d were not profiled\n",
+                atomic_load(&untracked_mutex_acquisitions), LOCK_PROFILER_MAX_MUTEXES);
+    }
+
+    fflush(stream);
+}
+
+#endif
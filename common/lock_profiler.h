@@ -0,0 +1,54 @@
+/*
+ * lock_profiler.h
+ *
+ *  @brief Contention profiling for the pthread mutexes shared between threads
+ *
+ *  Lock and unlock mutexes through profiled_mutex_lock and profiled_mutex_unlock.  Built with
+ *  -DLOCK_PROFILE they record, per mutex, how often it was acquired and contended, histograms of
+ *  the time spent waiting for it and holding it, and the call sites that held it longest.  The
+ *  report goes to stderr at exit, and after SIGUSR1 at the next profiled unlock, since the
+ *  signal handler itself cannot safely format it.  Without LOCK_PROFILE the macros are the
+ *  plain pthread calls, so nothing is added to the lock path.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdio.h>
+
+#ifdef LOCK_PROFILE
+
+/**
+ * Locks @param mutex, charging the wait to it and the hold that follows to the calling site
+ * @return the result of pthread_mutex_lock
+ */
+extern int lock_profiler_lock(pthread_mutex_t *mutex, const char *name, const char *file, int line);
+
+/**
+ * Unlocks @param mutex, ending the hold started by lock_profiler_lock
+ * @return the result of pthread_mutex_unlock
+ */
+extern int lock_profiler_unlock(pthread_mutex_t *mutex);
+
+/**
+ * Names @param mutex in the report.  Otherwise it is named by the expression first used to lock
+ * it, which differs between call sites that reach it through different pointers.
+ */
+extern void lock_profiler_name(pthread_mutex_t *mutex, const char *name);
+
+/**
+ * Writes the statistics of every profiled mutex to @param stream
+ */
+extern void lock_profiler_report(FILE *stream);
+
+#define profiled_mutex_lock(mutex) lock_profiler_lock((mutex), #mutex, __FILE__, __LINE__)
+#define profiled_mutex_unlock(mutex) lock_profiler_unlock(mutex)
+#define profiled_mutex_name(mutex, name) lock_profiler_name((mutex), (name))
+
+#else
+
+#define profiled_mutex_lock(mutex) pthread_mutex_lock(mutex)
+#define profiled_mutex_unlock(mutex) pthread_mutex_unlock(mutex)
+#define profiled_mutex_name(mutex, name) ((void)0)
+
+#endif
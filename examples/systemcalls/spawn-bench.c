@@ -0,0 +1,134 @@
+/**
+ * @file spawn-bench.c
+ * @brief Compares do_exec_method latency for each exec method as the parent's heap grows
+ *
+ * For each heap size the parent allocates and touches that much memory, so it is backed by
+ * page tables fork must copy, then times running /bin/true with each method.
+ */
+
+#include "systemcalls.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *const method_names[] = {"posix_spawn", "clone_vfork", "fork"};
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-c command] [heap MiB ...]\n", name);
+    fprintf(stderr, "Defaults: -n 200 -c /bin/true 0 64 256 1024\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t default_heap_sizes[] = {0, 64, 256, 1024};
+    char *command[] = {"/bin/true", NULL};
+    unsigned int iterations = 200;
+    int result = 0;
+    int saved_stdout;
+    int null_fd;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:c:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            command[0] = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (iterations == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // do_exec_method reports every exit code on stdout, keep it out of the results
+    saved_stdout = dup(STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || null_fd < 0)
+    {
+        perror("open");
+        return 1;
+    }
+
+    printf("%-12s %10s %12s %12s\n", "method", "heap_MiB", "mean_us", "max_us");
+    for (int i = 0; i < ((optind < argc) ? argc - optind : (int)(sizeof(default_heap_sizes) / sizeof(default_heap_sizes[0]))); ++i)
+    {
+        size_t heap_mib = (optind < argc) ? strtoul(argv[optind + i], NULL, 10) : default_heap_sizes[i];
+        char *heap = NULL;
+
+        if (heap_mib != 0)
+        {
+            heap = malloc(heap_mib << 20);
+            if (heap == NULL)
+            {
+                perror("malloc");
+                result = 1;
+                break;
+            }
+
+            memset(heap, 1, heap_mib << 20);
+        }
+
+        for (exec_method_t method = EXEC_METHOD_POSIX_SPAWN; method <= EXEC_METHOD_FORK; ++method)
+        {
+            uint64_t total_ns = 0;
+            uint64_t max_ns = 0;
+            bool succeeded = true;
+
+            fflush(stdout);
+            dup2(null_fd, STDOUT_FILENO);
+            for (unsigned int n = 0; n < iterations && succeeded; ++n)
+            {
+                uint64_t start = now_ns();
+                uint64_t elapsed;
+
+                succeeded = do_exec_method(method, NULL, command);
+                elapsed = now_ns() - start;
+                total_ns += elapsed;
+                max_ns = (elapsed > max_ns) ? elapsed : max_ns;
+            }
+
+            fflush(stdout);
+            dup2(saved_stdout, STDOUT_FILENO);
+
+            if (!succeeded)
+            {
+                fprintf(stderr, "%s failed to run %s\n", method_names[method], command[0]);
+                result = 1;
+                continue;
+            }
+
+            printf("%-12s %10zu %12.1f %12.1f\n", method_names[method], heap_mib, total_ns / 1e3 / iterations, max_ns / 1e3);
+        }
+
+        free(heap);
+    }
+
+    close(null_fd);
+    close(saved_stdout);
+
+    return result;
+}
@@ -1,11 +1,30 @@
+#define _GNU_SOURCE // clone()
+
 #include "systemcalls.h"
 
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#define CLONE_VFORK_STACK_SIZE (64 * 1024)
+#define EXEC_BATCH_MAX_EVENTS 16
+#define EXEC_BATCH_SIGCHLD_TIMEOUT_NS (100 * 1000 * 1000)
+#define EXEC_CAPTURE_READ_SIZE 4096
+#define EXEC_CAPTURE_SPLICE_SIZE (64 * 1024)
+
+extern char **environ;
+
 /**
  * @param cmd the command to execute with system()
  * @return true if the command in @param cmd was executed
@@ -29,6 +48,250 @@ bool do_system(const char *cmd)
     return true;
 }
 
+/**
+* Starts @param command with fork() and execv(), with stdout redirected to @param outputfile
+*   if it is not NULL.  Forking copies the page tables of the parent, so the cost grows with
+*   the size of the parent.
+* @return the pid of the child, or -1 if it could not be started
+*/
+static pid_t spawn_fork(const char *outputfile, char *const command[])
+{
+    pid_t childID;
+    int fd = -1;
+
+    if(outputfile != NULL) {
+        fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT, 0644);
+        if(fd < 0) {
+            perror("Open Failed");
+            return -1;
+        }
+    }
+
+    fflush(stdout);
+    switch(childID = fork()) {
+    case -1:
+        perror("Fork Failed");
+        break;
+    case 0:
+        if(fd >= 0 && dup2(fd, 1) < 0) {
+            perror("Dup2 Failed");
+            exit(1);
+        }
+
+        if(fd >= 0) {
+            close(fd);
+        }
+
+        execv(command[0], command);
+        perror("Execv Failed");
+        exit(1);
+    default:
+        break;
+    }
+
+    if(fd >= 0) {
+        close(fd);
+    }
+
+    return childID;
+}
+
+/**
+* Starts @param command with posix_spawn(), applying the file @param actions in the child.
+*   glibc implements posix_spawn with a vfork style clone, so no page tables are copied and a
+*   failed execv is reported back as an error.
+* @param child_mask if not NULL is the signal mask the child starts with, instead of the caller's
+* @return the pid of the child, or -1 if it could not be started
+*/
+static pid_t spawn_posix_actions(char *const command[], const posix_spawn_file_actions_t *actions, const sigset_t *child_mask)
+{
+    posix_spawnattr_t attributes;
+    pid_t childID;
+    int result;
+
+    if(posix_spawnattr_init(&attributes) != 0) {
+        return -1;
+    }
+
+    if(child_mask != NULL) {
+        posix_spawnattr_setsigmask(&attributes, child_mask);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+    }
+
+    fflush(stdout);
+    result = posix_spawn(&childID, command[0], actions, &attributes, command, environ);
+    posix_spawnattr_destroy(&attributes);
+    if(result != 0) {
+        fprintf(stderr, "posix_spawn %s: %s\n", command[0], strerror(result));
+        return -1;
+    }
+
+    return childID;
+}
+
+/**
+* Starts @param command with posix_spawn().  The redirect to @param outputfile is a file action,
+*   so the file is opened by the child and the parent never holds a descriptor that another
+*   thread's fork could inherit.
+* @param child_mask see spawn_posix_actions
+* @return the pid of the child, or -1 if it could not be started
+*/
+static pid_t spawn_posix(const char *outputfile, char *const command[], const sigset_t *child_mask)
+{
+    posix_spawn_file_actions_t actions;
+    pid_t childID;
+    int result;
+
+    if(posix_spawn_file_actions_init(&actions) != 0) {
+        return -1;
+    }
+
+    if(outputfile != NULL) {
+        result = posix_spawn_file_actions_addopen(&actions, 1, outputfile, O_WRONLY|O_TRUNC|O_CREAT, 0644);
+        if(result != 0) {
+            fprintf(stderr, "posix_spawn_file_actions_addopen: %s\n", strerror(result));
+            posix_spawn_file_actions_destroy(&actions);
+            return -1;
+        }
+    }
+
+    childID = spawn_posix_actions(command, &actions, child_mask);
+    posix_spawn_file_actions_destroy(&actions);
+
+    return childID;
+}
+
+typedef struct CloneVforkArguments
+{
+    const char *outputfile;
+    char *const *command;
+    sigset_t *signal_mask;
+    /**
+     * Set by the child when the redirect or execv fails.  The child shares the parent's memory
+     * until it execs, so the parent sees it as soon as clone returns.
+     */
+    int error;
+} CloneVforkArguments;
+
+/**
+* Runs in the child on its own stack, sharing the parent's memory, so it may only make system
+*   calls and must never return into or modify the parent's state beyond error.
+*/
+static int clone_vfork_child(void *arguments)
+{
+    CloneVforkArguments *clone_arguments = (CloneVforkArguments *)arguments;
+
+    if(clone_arguments->outputfile != NULL) {
+        int fd = open(clone_arguments->outputfile, O_WRONLY|O_TRUNC|O_CREAT, 0644);
+        if(fd < 0 || (fd != 1 && dup2(fd, 1) < 0)) {
+            clone_arguments->error = errno;
+            _exit(127);
+        }
+
+        if(fd != 1) {
+            close(fd);
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, clone_arguments->signal_mask, NULL);
+    execv(clone_arguments->command[0], clone_arguments->command);
+    clone_arguments->error = errno;
+    _exit(127);
+}
+
+/**
+* Starts @param command with clone(CLONE_VM|CLONE_VFORK), the same technique posix_spawn uses
+*   internally, spelled out for platforms where posix_spawn falls back to fork.  Signals are
+*   blocked until the child execs so no handler runs on the shared stack.
+* @return the pid of the child, or -1 if it could not be started
+*/
+static pid_t spawn_clone_vfork(const char *outputfile, char *const command[])
+{
+    CloneVforkArguments clone_arguments = {.outputfile = outputfile, .command = command, .error = 0};
+    sigset_t all_signals;
+    sigset_t old_mask;
+    pid_t childID;
+    char *stack = mmap(NULL, CLONE_VFORK_STACK_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+
+    if(stack == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+    clone_arguments.signal_mask = &old_mask;
+
+    fflush(stdout);
+    // The stack grows down on every architecture this runs on
+    childID = clone(clone_vfork_child, stack + CLONE_VFORK_STACK_SIZE, CLONE_VM|CLONE_VFORK|SIGCHLD, &clone_arguments);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    munmap(stack, CLONE_VFORK_STACK_SIZE);
+
+    if(childID == -1) {
+        perror("Clone Failed");
+        return -1;
+    }
+
+    // The child has already exited, reap it so it does not linger as a zombie
+    if(clone_arguments.error != 0) {
+        fprintf(stderr, "Execv %s: %s\n", command[0], strerror(clone_arguments.error));
+        waitpid(childID, NULL, 0);
+        return -1;
+    }
+
+    return childID;
+}
+
+/**
+* Waits for @param childID to exit.
+* @return true if it exited with status 0
+*/
+static bool wait_for_child(pid_t childID)
+{
+    int status;
+    if(waitpid(childID, &status, 0) == -1) {
+        perror("Waitpid Failed");
+        return false;
+    }
+
+    if(WIFEXITED(status)) {
+        const int exit_code = WEXITSTATUS(status);
+        printf("Exit Code: %d\n", exit_code);
+        if(exit_code == 0) {
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+bool do_exec_method(exec_method_t method, const char *outputfile, char *const command[])
+{
+    pid_t childID;
+
+    switch(method) {
+    case EXEC_METHOD_FORK:
+        childID = spawn_fork(outputfile, command);
+        break;
+    case EXEC_METHOD_CLONE_VFORK:
+        childID = spawn_clone_vfork(outputfile, command);
+        break;
+    case EXEC_METHOD_POSIX_SPAWN:
+    default:
+        childID = spawn_posix(outputfile, command, NULL);
+        break;
+    }
+
+    if(childID == -1) {
+        return false;
+    }
+
+    return wait_for_child(childID);
+}
+
 /**
 * @param count -The numbers of variables passed to the function. The variables are command to execute.
 *   followed by arguments to pass to the command
@@ -65,39 +328,7 @@ bool do_exec(int count, ...)
  *   as second argument to the execv() command.
  *
 */
-    int childID;
-    fflush(stdout);
-    switch(childID = fork()) {
-    case -1:
-        perror("Fork Failed");
-        return false;
-    case 0:
-        printf("Executing command in new process\n");
-        execv(command[0], command);
-        perror("Execv Failed");
-        exit(1);
-    default:
-        break;
-    }
-
-    int status;
-    if(waitpid(childID, &status, 0) == -1) {
-        perror("Waitpid Failed");
-        return false;
-    }
-
-    if(WIFEXITED(status)) {
-        const int exit_code = WEXITSTATUS(status);
-        printf("Exit Code: %d\n", exit_code);
-        if(exit_code == 0) {
-            return true;
-        } else {
-            return false;
-        }
-    }
-
-
-    return true;
+    return do_exec_method(EXEC_METHOD_POSIX_SPAWN, NULL, command);
 }
 
 /**
@@ -126,46 +357,313 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
  *
 */
 
-    int childID;
-    int fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT, 0644);
-    fflush(stdout);
-    switch(childID = fork()) {
-    case -1:
-        close(fd);
-        perror("Fork Failed");
+    return do_exec_method(EXEC_METHOD_POSIX_SPAWN, outputfile, command);
+}
+
+/**
+* @return a pidfd for @param pid, or -1 with errno set to ENOSYS where the kernel or the C
+*   library headers predate pidfd_open (Linux 5.3)
+*/
+static int exec_batch_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+* Reaps @param pid for @param entry if it has exited, or waits for it unless @param options
+*   holds WNOHANG.  entry->wall_time holds the start time until the child is reaped.
+* @return true if the child was reaped
+*/
+static bool exec_batch_reap(exec_batch_entry_t *entry, pid_t pid, int options)
+{
+    struct timespec end;
+    int status;
+
+    if(waitpid(pid, &status, options) != pid) {
         return false;
-    case 0:
-        if(dup2(fd, 1) < 0) {
-            perror("Dup2 Failed");
-            exit(1);
-        }
+    }
 
-        close(fd);
-        execv(command[0], command);
-        perror("Execv Failed");
-        exit(1);
-    default:
-        close(fd);
-        break;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    entry->wall_time.tv_sec = end.tv_sec - entry->wall_time.tv_sec;
+    entry->wall_time.tv_nsec = end.tv_nsec - entry->wall_time.tv_nsec;
+    if(entry->wall_time.tv_nsec < 0) {
+        entry->wall_time.tv_sec--;
+        entry->wall_time.tv_nsec += 1000000000L;
     }
 
-    int status;
-    if(waitpid(childID, &status, 0) == -1) {
-        perror("Waitpid Failed");
+    entry->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+    return true;
+}
+
+bool do_exec_batch(exec_batch_entry_t *entries, size_t count, size_t concurrency)
+{
+    pid_t *pids = calloc(count, sizeof(pid_t));
+    int *pidfds = calloc(count, sizeof(int));
+    int epoll_fd = -1;
+    size_t next = 0;
+    size_t running = 0;
+    bool use_pidfd = false;
+    bool success = true;
+    sigset_t sigchld_mask;
+    sigset_t old_mask;
+
+    if(pids == NULL || pidfds == NULL) {
+        free(pids);
+        free(pidfds);
         return false;
     }
 
-    if(WIFEXITED(status)) {
-        const int exit_code = WEXITSTATUS(status);
-        printf("Exit code: %d\n", exit_code);
-        if(exit_code == 0) {
-            return true;
+    if(concurrency == 0) {
+        concurrency = 1;
+    }
+
+    // Probe with our own pid, so the fallback is chosen once rather than per child
+    int probe = exec_batch_pidfd_open(getpid());
+    if(probe >= 0) {
+        close(probe);
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        use_pidfd = (epoll_fd >= 0);
+    }
+
+    // Without pidfds, SIGCHLD stays pending until sigtimedwait takes it, so none are missed
+    sigemptyset(&sigchld_mask);
+    sigaddset(&sigchld_mask, SIGCHLD);
+    if(!use_pidfd) {
+        pthread_sigmask(SIG_BLOCK, &sigchld_mask, &old_mask);
+    }
+
+    while(next < count || running > 0) {
+        while(running < concurrency && next < count) {
+            exec_batch_entry_t *entry = &entries[next];
+
+            entry->exit_status = -1;
+            clock_gettime(CLOCK_MONOTONIC, &entry->wall_time);
+            pids[next] = spawn_posix(NULL, entry->command, use_pidfd ? NULL : &old_mask);
+            if(pids[next] == -1) {
+                entry->wall_time = (struct timespec){0};
+                pids[next++] = 0;
+                continue;
+            }
+
+            if(use_pidfd) {
+                struct epoll_event event = {.events = EPOLLIN, .data.u64 = next};
+
+                pidfds[next] = exec_batch_pidfd_open(pids[next]);
+                if(pidfds[next] < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfds[next], &event) != 0) {
+                    // Cannot be watched, so wait for this one in place
+                    perror("pidfd_open");
+                    if(pidfds[next] >= 0) {
+                        close(pidfds[next]);
+                    }
+                    exec_batch_reap(entry, pids[next], 0);
+                    pids[next++] = 0;
+                    continue;
+                }
+            }
+
+            running++;
+            next++;
+        }
+
+        if(running == 0) {
+            continue;
+        }
+
+        if(use_pidfd) {
+            struct epoll_event events[EXEC_BATCH_MAX_EVENTS];
+            int ready = epoll_wait(epoll_fd, events, EXEC_BATCH_MAX_EVENTS, -1);
+            if(ready == -1 && errno != EINTR) {
+                perror("epoll_wait");
+                break;
+            }
+
+            for(int i = 0; i < ready; i++) {
+                size_t index = events[i].data.u64;
+
+                exec_batch_reap(&entries[index], pids[index], 0);
+                // Closing the pidfd also removes it from the epoll set
+                close(pidfds[index]);
+                pids[index] = 0;
+                running--;
+            }
         } else {
-            printf("Returning false\n");
+            struct timespec timeout = {.tv_nsec = EXEC_BATCH_SIGCHLD_TIMEOUT_NS};
+
+            // SIGCHLD coalesces and may go to another thread, so sweep every running child and
+            // bound the wait in case the signal was taken elsewhere
+            sigtimedwait(&sigchld_mask, NULL, &timeout);
+            for(size_t i = 0; i < next; i++) {
+                if(pids[i] > 0 && exec_batch_reap(&entries[i], pids[i], WNOHANG)) {
+                    pids[i] = 0;
+                    running--;
+                }
+            }
+        }
+    }
+
+    // Only reached with children running if waiting failed, never leave them as zombies
+    for(size_t i = 0; i < next; i++) {
+        if(pids[i] > 0) {
+            exec_batch_reap(&entries[i], pids[i], 0);
+            if(use_pidfd) {
+                close(pidfds[i]);
+            }
+        }
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        if(i >= next) {
+            entries[i].exit_status = -1;
+            entries[i].wall_time = (struct timespec){0};
+        }
+
+        success &= (entries[i].exit_status == 0);
+    }
+
+    if(use_pidfd) {
+        close(epoll_fd);
+    } else {
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    }
+
+    free(pidfds);
+    free(pids);
+
+    return success;
+}
+
+/**
+* Moves whatever is readable on @param pipe_fd into @param capture.
+* @return false at end of file or on error, true while the stream is still open
+*/
+static bool exec_capture_drain(exec_capture_t *capture, int pipe_fd)
+{
+    char discard[EXEC_CAPTURE_READ_SIZE];
+    ssize_t moved;
+
+    if(capture->splice_fd >= 0) {
+        moved = splice(pipe_fd, NULL, capture->splice_fd, NULL, EXEC_CAPTURE_SPLICE_SIZE, SPLICE_F_MOVE);
+        if(moved >= 0 || errno != EINVAL) {
+            if(moved > 0) {
+                capture->size += moved;
+            }
+            return moved > 0;
+        }
+
+        // The target cannot be spliced into (O_APPEND, or a file system without support), so copy
+        char copy[EXEC_CAPTURE_READ_SIZE];
+        moved = read(pipe_fd, copy, sizeof(copy));
+        if(moved > 0) {
+            if(write(capture->splice_fd, copy, moved) != moved) {
+                return false;
+            }
+            capture->size += moved;
+        }
+        return moved > 0;
+    }
+
+    if(capture->growable && capture->capacity - capture->size < EXEC_CAPTURE_READ_SIZE) {
+        size_t capacity = (capture->capacity < EXEC_CAPTURE_READ_SIZE) ? 2 * EXEC_CAPTURE_READ_SIZE : 2 * capture->capacity;
+        char *data = realloc(capture->data, capacity);
+        if(data == NULL) {
             return false;
         }
+
+        capture->data = data;
+        capture->capacity = capacity;
     }
 
+    // A full fixed buffer keeps draining so the child never blocks on a full pipe
+    if(capture->size == capture->capacity) {
+        moved = read(pipe_fd, discard, sizeof(discard));
+        capture->truncated |= (moved > 0);
+        return moved > 0;
+    }
 
-    return true;
+    moved = read(pipe_fd, capture->data + capture->size, capture->capacity - capture->size);
+    if(moved > 0) {
+        capture->size += moved;
+    }
+
+    return moved > 0;
+}
+
+bool do_exec_capture(exec_capture_t *out, exec_capture_t *err, char *const command[])
+{
+    exec_capture_t *captures[2] = {out, err};
+    int pipes[2][2] = {{-1, -1}, {-1, -1}};
+    struct pollfd poll_fds[2];
+    posix_spawn_file_actions_t actions;
+    pid_t childID = -1;
+    bool success = false;
+
+    if(posix_spawn_file_actions_init(&actions) != 0) {
+        return false;
+    }
+
+    // Close on exec, so only the duplicates on the child's stdout and stderr survive the execv
+    for(int i = 0; i < 2; i++) {
+        if(captures[i] == NULL) {
+            continue;
+        }
+
+        captures[i]->size = 0;
+        captures[i]->truncated = false;
+        if(pipe2(pipes[i], O_CLOEXEC) != 0) {
+            perror("pipe2");
+            goto pipe_failed;
+        }
+
+        if(posix_spawn_file_actions_adddup2(&actions, pipes[i][1], i + 1) != 0) {
+            goto pipe_failed;
+        }
+    }
+
+    childID = spawn_posix_actions(command, &actions, NULL);
+
+pipe_failed:
+    posix_spawn_file_actions_destroy(&actions);
+    for(int i = 0; i < 2; i++) {
+        if(pipes[i][1] >= 0) {
+            close(pipes[i][1]);
+        }
+
+        poll_fds[i] = (struct pollfd){.fd = (childID == -1) ? -1 : pipes[i][0], .events = POLLIN};
+    }
+
+    // Poll both streams together so a child blocked writing one can never deadlock with us
+    // blocked reading the other
+    while(poll_fds[0].fd >= 0 || poll_fds[1].fd >= 0) {
+        if(poll(poll_fds, 2, -1) == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        for(int i = 0; i < 2; i++) {
+            if(poll_fds[i].fd >= 0 && poll_fds[i].revents != 0 && !exec_capture_drain(captures[i], poll_fds[i].fd)) {
+                poll_fds[i].fd = -1;
+            }
+        }
+    }
+
+    for(int i = 0; i < 2; i++) {
+        if(pipes[i][0] >= 0) {
+            close(pipes[i][0]);
+        }
+    }
+
+    if(childID != -1) {
+        success = wait_for_child(childID);
+    }
+
+    return success;
 }
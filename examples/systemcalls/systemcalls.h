@@ -1,9 +1,92 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
 
 bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+ * How do_exec_method starts a child process.
+ * EXEC_METHOD_FORK copies the parent's page tables, so its cost grows with the parent's size.
+ * EXEC_METHOD_POSIX_SPAWN and EXEC_METHOD_CLONE_VFORK share the parent's memory until the
+ * child execs, so their cost is independent of it.
+ */
+typedef enum {
+    EXEC_METHOD_POSIX_SPAWN,
+    EXEC_METHOD_CLONE_VFORK,
+    EXEC_METHOD_FORK,
+} exec_method_t;
+
+/**
+ * Runs the NULL terminated @param command, command[0] being the full path to execute, using
+ * @param method and waits for it.  stdout is redirected to @param outputfile unless it is NULL.
+ * @return true if the command ran and exited with status 0
+ */
+bool do_exec_method(exec_method_t method, const char *outputfile, char *const command[]);
+
+/**
+ * One command for do_exec_batch.
+ */
+typedef struct {
+    /**
+     * NULL terminated argument vector, command[0] being the full path to execute
+     */
+    char *const *command;
+    /**
+     * Set to the exit code of the command, or -1 if it could not be started or was killed
+     */
+    int exit_status;
+    /**
+     * Set to the time from starting the command until it was reaped
+     */
+    struct timespec wall_time;
+} exec_batch_entry_t;
+
+/**
+ * Runs the @param count commands in @param entries, at most @param concurrency at a time, and
+ * fills in their exit_status and wall_time.  Completions are waited for with pidfds in an epoll
+ * set, or with SIGCHLD where pidfd_open is not available.
+ * @return true if every command exited with status 0
+ */
+bool do_exec_batch(exec_batch_entry_t *entries, size_t count, size_t concurrency);
+
+/**
+ * Where do_exec_capture puts one output stream of the command.
+ */
+typedef struct {
+    /**
+     * Buffer the output is stored in.  A growable buffer may start NULL and is realloc'd as
+     * needed; the caller frees it.
+     */
+    char *data;
+    /**
+     * Number of bytes available at data
+     */
+    size_t capacity;
+    /**
+     * When false, output beyond capacity is read and discarded, and truncated is set
+     */
+    bool growable;
+    /**
+     * If not negative, the output is spliced to this descriptor instead of being stored in data
+     */
+    int splice_fd;
+    /**
+     * Set to the number of bytes captured, or moved to splice_fd
+     */
+    size_t size;
+    bool truncated;
+} exec_capture_t;
+
+/**
+ * Runs the NULL terminated @param command, command[0] being the full path to execute, with its
+ * stdout and stderr captured through pipes into @param out and @param err.  Either may be NULL
+ * to leave that stream connected to ours.  Nothing is written to disk unless splice_fd is.
+ * @return true if the command ran and exited with status 0
+ */
+bool do_exec_capture(exec_capture_t *out, exec_capture_t *err, char *const command[]);
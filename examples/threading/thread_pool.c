@@ -0,0 +1,631 @@
+#include "thread_pool.h"
+#include "threading.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../common/lock_profiler.h"
+
+// Must be a power of two.  A worker whose deque is full submits through the shared queue.
+#define THREAD_POOL_DEQUE_CAPACITY 4096
+#define THREAD_POOL_CACHE_LINE 64
+#define THREAD_POOL_NO_TIMER UINT64_MAX
+
+struct thread_pool_future {
+    struct thread_pool *pool;
+    thread_pool_task_t task;
+    void *argument;
+
+    /**
+     * Monotonic time a delayed task becomes runnable
+     */
+    struct timespec deadline;
+    /**
+     * Link in the shared queue
+     */
+    struct thread_pool_future *next;
+
+    /**
+     * One for the submitter and one for the pool, the last to release frees the future
+     */
+    atomic_int references;
+    atomic_bool complete;
+    bool thread_complete_success;
+};
+
+/**
+ * Chase-Lev deque: the owning worker pushes and pops at bottom, thieves take from top.  Indices
+ * only grow, and top and bottom sit on separate cache lines so thieves do not contend with the
+ * owner until the deque is nearly empty.
+ */
+struct work_deque {
+    _Alignas(THREAD_POOL_CACHE_LINE) atomic_llong top;
+    _Alignas(THREAD_POOL_CACHE_LINE) atomic_llong bottom;
+    _Alignas(THREAD_POOL_CACHE_LINE) _Atomic(struct thread_pool_future *) tasks[THREAD_POOL_DEQUE_CAPACITY];
+};
+
+struct thread_pool_worker {
+    struct work_deque deque;
+    struct thread_pool *pool;
+    pthread_t thread;
+    size_t index;
+};
+
+struct thread_pool {
+    /**
+     * Protects the shared queue and the timer heap, and pairs with both condition variables
+     */
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    pthread_cond_t task_completed;
+
+    struct thread_pool_future *shared_head;
+    struct thread_pool_future *shared_tail;
+    atomic_long shared_count;
+
+    /**
+     * Delayed tasks, a min-heap on deadline.  next_timer_ns lets busy workers check for due
+     * timers without taking the mutex.
+     */
+    struct thread_pool_future **timers;
+    size_t timer_count;
+    size_t timer_capacity;
+    atomic_uint_fast64_t next_timer_ns;
+
+    /**
+     * Tasks runnable in a deque or the shared queue, and tasks submitted but not yet run
+     */
+    atomic_long queued;
+    atomic_long outstanding;
+
+    atomic_int sleeping_workers;
+    atomic_int completion_waiters;
+    atomic_bool stopping;
+
+    struct thread_pool_worker *workers;
+    size_t worker_count;
+};
+
+static _Thread_local struct thread_pool_worker *current_worker = NULL;
+
+static uint64_t timespec_to_ns(const struct timespec *time)
+{
+    return (uint64_t)time->tv_sec * 1000000000ULL + time->tv_nsec;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return timespec_to_ns(&now);
+}
+
+static struct timespec monotonic_after(const struct timespec *delay)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += delay->tv_sec;
+    deadline.tv_nsec += delay->tv_nsec;
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    return deadline;
+}
+
+static bool deque_push(struct work_deque *deque, struct thread_pool_future *future)
+{
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if(bottom - top >= THREAD_POOL_DEQUE_CAPACITY) {
+        return false;
+    }
+
+    atomic_store_explicit(&deque->tasks[bottom & (THREAD_POOL_DEQUE_CAPACITY - 1)], future, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+    return true;
+}
+
+static struct thread_pool_future *deque_pop(struct work_deque *deque)
+{
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    long long top;
+    struct thread_pool_future *future = NULL;
+
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if(top <= bottom) {
+        future = atomic_load_explicit(&deque->tasks[bottom & (THREAD_POOL_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+        if(top == bottom) {
+            // Last task, race any thief for it
+            if(!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+                future = NULL;
+            }
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return future;
+}
+
+static struct thread_pool_future *deque_steal(struct work_deque *deque)
+{
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    long long bottom;
+    struct thread_pool_future *future;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if(top >= bottom) {
+        return NULL;
+    }
+
+    future = atomic_load_explicit(&deque->tasks[top & (THREAD_POOL_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    return future;
+}
+
+static void shared_push_locked(struct thread_pool *pool, struct thread_pool_future *future)
+{
+    future->next = NULL;
+    if(pool->shared_tail == NULL) {
+        pool->shared_head = future;
+    } else {
+        pool->shared_tail->next = future;
+    }
+
+    pool->shared_tail = future;
+    atomic_fetch_add(&pool->shared_count, 1);
+}
+
+static struct thread_pool_future *shared_pop(struct thread_pool *pool)
+{
+    struct thread_pool_future *future;
+
+    if(atomic_load_explicit(&pool->shared_count, memory_order_relaxed) <= 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    future = pool->shared_head;
+    if(future != NULL) {
+        pool->shared_head = future->next;
+        if(pool->shared_head == NULL) {
+            pool->shared_tail = NULL;
+        }
+        atomic_fetch_sub(&pool->shared_count, 1);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return future;
+}
+
+static void timer_swap(struct thread_pool *pool, size_t a, size_t b)
+{
+    struct thread_pool_future *future = pool->timers[a];
+
+    pool->timers[a] = pool->timers[b];
+    pool->timers[b] = future;
+}
+
+static bool timer_before(struct thread_pool *pool, size_t a, size_t b)
+{
+    return timespec_to_ns(&pool->timers[a]->deadline) < timespec_to_ns(&pool->timers[b]->deadline);
+}
+
+static bool timer_push_locked(struct thread_pool *pool, struct thread_pool_future *future)
+{
+    size_t child = pool->timer_count;
+
+    if(pool->timer_count == pool->timer_capacity) {
+        size_t capacity = (pool->timer_capacity == 0) ? 16 : 2 * pool->timer_capacity;
+        struct thread_pool_future **timers = realloc(pool->timers, capacity * sizeof(*timers));
+        if(timers == NULL) {
+            return false;
+        }
+
+        pool->timers = timers;
+        pool->timer_capacity = capacity;
+    }
+
+    pool->timers[pool->timer_count++] = future;
+    while(child > 0 && timer_before(pool, child, (child - 1) / 2)) {
+        timer_swap(pool, child, (child - 1) / 2);
+        child = (child - 1) / 2;
+    }
+
+    atomic_store(&pool->next_timer_ns, timespec_to_ns(&pool->timers[0]->deadline));
+
+    return true;
+}
+
+static void timer_pop_locked(struct thread_pool *pool)
+{
+    size_t parent = 0;
+
+    pool->timers[0] = pool->timers[--pool->timer_count];
+    for(;;) {
+        size_t smallest = parent;
+        size_t left = 2 * parent + 1;
+
+        if(left < pool->timer_count && timer_before(pool, left, smallest)) {
+            smallest = left;
+        }
+        if(left + 1 < pool->timer_count && timer_before(pool, left + 1, smallest)) {
+            smallest = left + 1;
+        }
+        if(smallest == parent) {
+            break;
+        }
+
+        timer_swap(pool, parent, smallest);
+        parent = smallest;
+    }
+
+    atomic_store(&pool->next_timer_ns, (pool->timer_count == 0) ? THREAD_POOL_NO_TIMER : timespec_to_ns(&pool->timers[0]->deadline));
+}
+
+/**
+* Moves every delayed task whose deadline has passed to the shared queue.
+*/
+static void release_due_timers_locked(struct thread_pool *pool)
+{
+    uint64_t now = monotonic_ns();
+
+    while(pool->timer_count > 0 && timespec_to_ns(&pool->timers[0]->deadline) <= now) {
+        shared_push_locked(pool, pool->timers[0]);
+        timer_pop_locked(pool);
+        atomic_fetch_add(&pool->queued, 1);
+    }
+}
+
+static void wake_worker(struct thread_pool *pool)
+{
+    if(atomic_load(&pool->sleeping_workers) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_signal(&pool->work_available);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static struct thread_pool_future *find_task(struct thread_pool_worker *worker)
+{
+    struct thread_pool *pool = worker->pool;
+    struct thread_pool_future *future;
+
+    if(atomic_load_explicit(&pool->next_timer_ns, memory_order_relaxed) <= monotonic_ns()) {
+        pthread_mutex_lock(&pool->mutex);
+        release_due_timers_locked(pool);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    future = deque_pop(&worker->deque);
+    if(future == NULL) {
+        future = shared_pop(pool);
+    }
+
+    for(size_t i = 1; future == NULL && i < pool->worker_count; i++) {
+        future = deque_steal(&pool->workers[(worker->index + i) % pool->worker_count].deque);
+    }
+
+    return future;
+}
+
+void thread_pool_future_release(struct thread_pool_future *future)
+{
+    if(future != NULL && atomic_fetch_sub(&future->references, 1) == 1) {
+        free(future);
+    }
+}
+
+static void run_task(struct thread_pool *pool, struct thread_pool_future *future)
+{
+    future->thread_complete_success = future->task(future->argument);
+    atomic_store(&future->complete, true);
+
+    if(atomic_load(&pool->completion_waiters) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->task_completed);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    thread_pool_future_release(future);
+
+    // The last task of a stopping pool lets the sleeping workers exit
+    if(atomic_fetch_sub(&pool->outstanding, 1) == 1 && atomic_load(&pool->stopping)) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->work_available);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static void* worker_thread_function(void* thread_param)
+{
+    struct thread_pool_worker *worker = (struct thread_pool_worker *)thread_param;
+    struct thread_pool *pool = worker->pool;
+
+    current_worker = worker;
+    for(;;) {
+        struct thread_pool_future *future = find_task(worker);
+        if(future != NULL) {
+            atomic_fetch_sub(&pool->queued, 1);
+            run_task(pool, future);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        release_due_timers_locked(pool);
+        if(atomic_load(&pool->stopping) && atomic_load(&pool->outstanding) == 0) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+
+        // Submitters bump queued before checking sleeping_workers, so one of us sees the other
+        atomic_fetch_add(&pool->sleeping_workers, 1);
+        if(atomic_load(&pool->queued) <= 0) {
+            if(pool->timer_count > 0) {
+                pthread_cond_timedwait(&pool->work_available, &pool->mutex, &pool->timers[0]->deadline);
+            } else {
+                pthread_cond_wait(&pool->work_available, &pool->mutex);
+            }
+        }
+        atomic_fetch_sub(&pool->sleeping_workers, 1);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    current_worker = NULL;
+
+    return NULL;
+}
+
+struct thread_pool *thread_pool_create(size_t worker_count)
+{
+    struct thread_pool *pool;
+    pthread_condattr_t condition_attributes;
+    size_t workers_size = (worker_count * sizeof(struct thread_pool_worker) + THREAD_POOL_CACHE_LINE - 1) & ~(size_t)(THREAD_POOL_CACHE_LINE - 1);
+    size_t started;
+
+    if(worker_count == 0) {
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(struct thread_pool));
+    if(pool == NULL) {
+        return NULL;
+    }
+
+    // Workers hold cache line aligned deques, so they cannot come from plain malloc
+    pool->workers = aligned_alloc(THREAD_POOL_CACHE_LINE, workers_size);
+    if(pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    memset(pool->workers, 0, workers_size);
+    pool->worker_count = worker_count;
+    atomic_init(&pool->next_timer_ns, THREAD_POOL_NO_TIMER);
+
+    // Deadlines are on the monotonic clock so wall clock changes cannot stretch a delay
+    pthread_condattr_init(&condition_attributes);
+    pthread_condattr_setclock(&condition_attributes, CLOCK_MONOTONIC);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_available, &condition_attributes);
+    pthread_cond_init(&pool->task_completed, &condition_attributes);
+    pthread_condattr_destroy(&condition_attributes);
+
+    for(started = 0; started < worker_count; started++) {
+        pool->workers[started].pool = pool;
+        pool->workers[started].index = started;
+        if(pthread_create(&pool->workers[started].thread, NULL, worker_thread_function, &pool->workers[started]) != 0) {
+            break;
+        }
+    }
+
+    if(started != worker_count) {
+        pool->worker_count = started;
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    atomic_store(&pool->stopping, true);
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(size_t i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->task_completed);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->timers);
+    free(pool->workers);
+    free(pool);
+}
+
+static struct thread_pool_future *future_create(struct thread_pool *pool, thread_pool_task_t task, void *argument)
+{
+    struct thread_pool_future *future = malloc(sizeof(struct thread_pool_future));
+    if(future == NULL) {
+        return NULL;
+    }
+
+    future->pool = pool;
+    future->task = task;
+    future->argument = argument;
+    future->next = NULL;
+    future->thread_complete_success = false;
+    atomic_init(&future->references, 2);
+    atomic_init(&future->complete, false);
+
+    return future;
+}
+
+struct thread_pool_future *thread_pool_submit(struct thread_pool *pool, thread_pool_task_t task, void *argument)
+{
+    struct thread_pool_future *future = future_create(pool, task, argument);
+    if(future == NULL) {
+        return NULL;
+    }
+
+    atomic_fetch_add(&pool->outstanding, 1);
+    if(current_worker == NULL || current_worker->pool != pool || !deque_push(&current_worker->deque, future)) {
+        pthread_mutex_lock(&pool->mutex);
+        shared_push_locked(pool, future);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    atomic_fetch_add(&pool->queued, 1);
+    wake_worker(pool);
+
+    return future;
+}
+
+struct thread_pool_future *thread_pool_submit_after(struct thread_pool *pool, const struct timespec *delay,
+                                                    thread_pool_task_t task, void *argument)
+{
+    struct thread_pool_future *future = future_create(pool, task, argument);
+    if(future == NULL) {
+        return NULL;
+    }
+
+    future->deadline = monotonic_after(delay);
+
+    pthread_mutex_lock(&pool->mutex);
+    if(!timer_push_locked(pool, future)) {
+        pthread_mutex_unlock(&pool->mutex);
+        free(future);
+        return NULL;
+    }
+
+    atomic_fetch_add(&pool->outstanding, 1);
+    // A sleeping worker may be waiting for a later deadline, wake one to recompute it
+    pthread_cond_signal(&pool->work_available);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return future;
+}
+
+bool thread_pool_future_timedwait(struct thread_pool_future *future, const struct timespec *timeout, bool *success)
+{
+    struct thread_pool *pool = future->pool;
+    struct timespec deadline;
+    bool complete = atomic_load(&future->complete);
+
+    if(!complete) {
+        if(timeout != NULL) {
+            deadline = monotonic_after(timeout);
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        atomic_fetch_add(&pool->completion_waiters, 1);
+        while(!(complete = atomic_load(&future->complete))) {
+            if(timeout == NULL) {
+                pthread_cond_wait(&pool->task_completed, &pool->mutex);
+            } else if(pthread_cond_timedwait(&pool->task_completed, &pool->mutex, &deadline) == ETIMEDOUT) {
+                complete = atomic_load(&future->complete);
+                break;
+            }
+        }
+        atomic_fetch_sub(&pool->completion_waiters, 1);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    if(complete && success != NULL) {
+        *success = future->thread_complete_success;
+    }
+
+    return complete;
+}
+
+bool thread_pool_future_wait(struct thread_pool_future *future)
+{
+    bool success = false;
+
+    thread_pool_future_timedwait(future, NULL, &success);
+
+    return success;
+}
+
+/**
+* Holds the mutex until an absolute deadline, so a signal interrupting the wait cannot stretch
+* the hold the way restarting a relative nanosleep does.
+*/
+static bool obtaining_mutex_task(void *argument)
+{
+    struct thread_data* thread_func_args = (struct thread_data*) argument;
+    struct timespec release_at;
+    int result;
+
+    thread_func_args->thread_complete_success = true;
+    if(profiled_mutex_lock(thread_func_args->thread_data_mutex) != 0) {
+        free(thread_func_args);
+        return false;
+    }
+
+    release_at = monotonic_after(&thread_func_args->wait_to_release);
+    while((result = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &release_at, NULL)) == EINTR) {
+    }
+
+    if(result != 0) {
+        thread_func_args->thread_complete_success = false;
+    }
+
+    if(profiled_mutex_unlock(thread_func_args->thread_data_mutex) != 0) {
+        thread_func_args->thread_complete_success = false;
+    }
+
+    result = thread_func_args->thread_complete_success;
+    free(thread_func_args);
+
+    return result;
+}
+
+struct thread_pool_future *thread_pool_submit_obtaining_mutex(struct thread_pool *pool, pthread_mutex_t *mutex,
+                                                              int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    struct thread_pool_future *future;
+    struct thread_data* thread_func_args = (struct thread_data*) malloc(sizeof(struct thread_data));
+    if(thread_func_args == NULL) {
+        return NULL;
+    }
+
+    thread_func_args->thread_data_mutex = mutex;
+    thread_func_args->thread_complete_success = true;
+
+    thread_func_args->wait_to_obtain.tv_sec = wait_to_obtain_ms/1000;
+    thread_func_args->wait_to_obtain.tv_nsec = (wait_to_obtain_ms%1000) * 1000000;
+
+    thread_func_args->wait_to_release.tv_sec = wait_to_release_ms/1000;
+    thread_func_args->wait_to_release.tv_nsec = (wait_to_release_ms%1000) * 1000000;
+
+    future = thread_pool_submit_after(pool, &thread_func_args->wait_to_obtain, obtaining_mutex_task, thread_func_args);
+    if(future == NULL) {
+        free(thread_func_args);
+    }
+
+    return future;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * A fixed set of worker threads, each with its own work stealing deque.  Tasks submitted from a
+ * worker go to the bottom of that worker's deque and are run from there, idle workers steal from
+ * the top of the others', and tasks submitted from any other thread go through a shared queue.
+ */
+struct thread_pool;
+
+/**
+ * Handle to a submitted task, carrying its thread_complete_success result once it has run.
+ * Every future returned by a submit function must be released with thread_pool_future_release,
+ * which may be done before the task runs to detach it.
+ */
+struct thread_pool_future;
+
+/**
+ * A task run by the pool.  The return value becomes the future's thread_complete_success.
+ */
+typedef bool (*thread_pool_task_t)(void *argument);
+
+/**
+* Starts a pool of @param worker_count threads.
+* @return the pool, or NULL if it could not be created
+*/
+struct thread_pool *thread_pool_create(size_t worker_count);
+
+/**
+* Waits for every submitted task, including delayed ones, to run, then stops the workers and
+* frees the pool.  Must not be called from a task.
+*/
+void thread_pool_destroy(struct thread_pool *pool);
+
+/**
+* Queues @param task to be called with @param argument.
+* @return the future for the task, or NULL if it could not be allocated
+*/
+struct thread_pool_future *thread_pool_submit(struct thread_pool *pool, thread_pool_task_t task, void *argument);
+
+/**
+* Queues @param task to be called with @param argument once @param delay has passed.  No worker
+* is occupied while the delay runs.
+* @return the future for the task, or NULL if it could not be allocated
+*/
+struct thread_pool_future *thread_pool_submit_after(struct thread_pool *pool, const struct timespec *delay,
+                                                    thread_pool_task_t task, void *argument);
+
+/**
+* Blocks until the task of @param future has run.
+* @return its thread_complete_success
+*/
+bool thread_pool_future_wait(struct thread_pool_future *future);
+
+/**
+* Blocks until the task of @param future has run or @param timeout has passed.
+* @param success is set to the task's thread_complete_success if it ran
+* @return true if the task ran, false on timeout
+*/
+bool thread_pool_future_timedwait(struct thread_pool_future *future, const struct timespec *timeout, bool *success);
+
+/**
+* Gives up the caller's reference to @param future.  The future is freed once its task has run.
+*/
+void thread_pool_future_release(struct thread_pool_future *future);
+
+/**
+* The pool equivalent of start_thread_obtaining_mutex: after @param wait_to_obtain_ms
+* milliseconds a worker obtains @param mutex, holds it for @param wait_to_release_ms
+* milliseconds, then releases it.  The first wait occupies no worker.  The hold does, since a
+* pthread mutex must be unlocked by the thread that locked it.
+* @return the future for the task, or NULL if it could not be submitted
+*/
+struct thread_pool_future *thread_pool_submit_obtaining_mutex(struct thread_pool *pool, pthread_mutex_t *mutex,
+                                                              int wait_to_obtain_ms, int wait_to_release_ms);
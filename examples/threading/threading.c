@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include "../../common/lock_profiler.h"
 
 // Optional: use these functions to add debug or error prints to your application
 #define DEBUG_LOG(msg,...)
@@ -21,7 +22,7 @@ void* threadfunc(void* thread_param)
         thread_func_args->thread_complete_success = false;
     }
 
-    if(pthread_mutex_lock(thread_func_args->thread_data_mutex) != 0) {
+    if(profiled_mutex_lock(thread_func_args->thread_data_mutex) != 0) {
         thread_func_args->thread_complete_success = false;
     }
 
@@ -30,7 +31,7 @@ void* threadfunc(void* thread_param)
         thread_func_args->thread_complete_success = false;
     }
 
-    if(pthread_mutex_unlock(thread_func_args->thread_data_mutex) != 0) {
+    if(profiled_mutex_unlock(thread_func_args->thread_data_mutex) != 0) {
         thread_func_args->thread_complete_success = false;
     }
 
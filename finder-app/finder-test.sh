@@ -53,12 +53,19 @@ fi
 # make clean
 # make
 
+# One batch mode writer writes every file, instead of one writer process per file
 for i in $( seq 1 $NUMFILES)
 do
-	writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-done
+	printf '%s\t%s\n' "$WRITEDIR/${username}$i.txt" "$WRITESTR"
+done | writer -b
 
-OUTPUTSTRING=$(finder.sh "$WRITEDIR" "$WRITESTR")
+# Prefer the compiled finder when it is installed, it prints the same line as finder.sh
+if command -v finder > /dev/null
+then
+	OUTPUTSTRING=$(finder "$WRITEDIR" "$WRITESTR")
+else
+	OUTPUTSTRING=$(finder.sh "$WRITEDIR" "$WRITESTR")
+fi
 echo $OUTPUTSTRING > /tmp/assignment4-result.txt
 # remove temporary directories
 rm -rf /tmp/aeld-data
@@ -0,0 +1,369 @@
+/**
+ * Native equivalent of finder.sh: counts the regular files under a directory and the lines in
+ * them matching a pattern, printing the same line the script does.
+ *
+ * Worker threads share a queue of directories and files.  Directories are listed with
+ * getdents64 and their entries opened relative to the directory's descriptor, files are
+ * mapped and searched in place.  Like find -type f, symbolic links are never followed.
+ *
+ * The pattern is a grep basic regular expression.  One without special characters is searched
+ * as a plain string with a vectorized matcher, anything else falls back to regexec per line.
+ */
+#define _GNU_SOURCE // getdents64()
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../aesd-char-driver/aesd-newline-scan.h"
+
+#define MAX_WORKERS 64
+#define DIRENT_BUFFER_SIZE 32768
+
+typedef signed char byte_vector_t __attribute__((vector_size(16)));
+
+// A directory stays open while any of its entries is still queued
+typedef struct directory {
+    int fd;
+    atomic_int references;
+} directory_t;
+
+typedef struct work_item {
+    struct work_item *next;
+    directory_t *parent;
+    bool is_directory;
+    char name[];
+} work_item_t;
+
+typedef struct pattern {
+    const char *string;
+    size_t length;
+    bool is_regex;
+    regex_t regex;
+} pattern_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    work_item_t *head;
+    // Items queued or being worked on, the walk is done when it drops to zero
+    size_t pending;
+} queue = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0};
+
+static pattern_t pattern;
+static atomic_size_t file_count;
+static atomic_size_t line_count;
+
+static void directory_release(directory_t *directory) {
+    if(directory != NULL && atomic_fetch_sub(&directory->references, 1) == 1) {
+        close(directory->fd);
+        free(directory);
+    }
+}
+
+static bool queue_push(directory_t *parent, const char *name, bool is_directory) {
+    size_t name_length = strlen(name) + 1;
+    work_item_t *item = malloc(sizeof(work_item_t) + name_length);
+    if(item == NULL) {
+        return false;
+    }
+
+    item->parent = parent;
+    item->is_directory = is_directory;
+    memcpy(item->name, name, name_length);
+    if(parent != NULL) {
+        atomic_fetch_add(&parent->references, 1);
+    }
+
+    pthread_mutex_lock(&queue.mutex);
+    item->next = queue.head;
+    queue.head = item;
+    queue.pending++;
+    pthread_cond_signal(&queue.work_available);
+    pthread_mutex_unlock(&queue.mutex);
+
+    return true;
+}
+
+/**
+* @return the next item, or NULL once every item has been worked on
+*/
+static work_item_t *queue_pop(void) {
+    work_item_t *item;
+
+    pthread_mutex_lock(&queue.mutex);
+    while(queue.head == NULL && queue.pending != 0) {
+        pthread_cond_wait(&queue.work_available, &queue.mutex);
+    }
+
+    item = queue.head;
+    if(item != NULL) {
+        queue.head = item->next;
+    }
+    pthread_mutex_unlock(&queue.mutex);
+
+    return item;
+}
+
+static void queue_done(work_item_t *item) {
+    directory_release(item->parent);
+    free(item);
+
+    pthread_mutex_lock(&queue.mutex);
+    if(--queue.pending == 0) {
+        pthread_cond_broadcast(&queue.work_available);
+    }
+    pthread_mutex_unlock(&queue.mutex);
+}
+
+/**
+* Candidate positions are those where both the first and last byte of the needle match, checked
+* 16 at a time, so most of the haystack is rejected without a byte compare.
+* @return the first occurrence of the needle in @param haystack, or NULL
+*/
+static const char *find_string(const char *haystack, size_t length, const char *needle, size_t needle_length) {
+    if(needle_length > length) {
+        return NULL;
+    }
+
+    const size_t end = length - needle_length + 1;
+    const byte_vector_t first = (byte_vector_t){0} + needle[0];
+    const byte_vector_t last = (byte_vector_t){0} + needle[needle_length - 1];
+    size_t i = 0;
+
+    for(; i + sizeof(byte_vector_t) <= end; i += sizeof(byte_vector_t)) {
+        byte_vector_t head;
+        byte_vector_t tail;
+        uint64_t hits[2];
+
+        memcpy(&head, haystack + i, sizeof(head));
+        memcpy(&tail, haystack + i + needle_length - 1, sizeof(tail));
+        byte_vector_t candidates = (head == first) & (tail == last);
+        memcpy(hits, &candidates, sizeof(hits));
+        if((hits[0] | hits[1]) == 0) {
+            continue;
+        }
+
+        for(size_t j = 0; j < sizeof(byte_vector_t); j++) {
+            if(candidates[j] != 0 && memcmp(haystack + i + j, needle, needle_length) == 0) {
+                return haystack + i + j;
+            }
+        }
+    }
+
+    for(; i < end; i++) {
+        const char *candidate = memchr(haystack + i, needle[0], end - i);
+        if(candidate == NULL) {
+            return NULL;
+        }
+
+        i = candidate - haystack;
+        if(memcmp(candidate, needle, needle_length) == 0) {
+            return candidate;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+* @return the number of lines in @param data matching the pattern, counted as grep -c does,
+* including a last line without a terminating newline
+*/
+static size_t count_matching_lines(const char *data, size_t length) {
+    size_t matches = 0;
+    size_t position = 0;
+
+    if(!pattern.is_regex) {
+        const char *match;
+
+        while(position < length && (match = find_string(data + position, length - position, pattern.string, pattern.length)) != NULL) {
+            size_t match_offset = match - data;
+
+            matches++;
+            position = match_offset + aesd_newline_find(match, length - match_offset) + 1;
+        }
+
+        return matches;
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+
+    while(position < length) {
+        size_t line_length = aesd_newline_find(data + position, length - position);
+
+        if(line_length + 1 > line_capacity) {
+            char *grown = realloc(line, line_length + 1);
+            if(grown == NULL) {
+                break;
+            }
+
+            line = grown;
+            line_capacity = line_length + 1;
+        }
+
+        memcpy(line, data + position, line_length);
+        line[line_length] = '\0';
+        if(regexec(&pattern.regex, line, 0, NULL, 0) == 0) {
+            matches++;
+        }
+
+        position += line_length + 1;
+    }
+
+    free(line);
+
+    return matches;
+}
+
+static void search_file(work_item_t *item) {
+    int fd = openat(item->parent->fd, item->name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat status;
+
+    if(fd == -1) {
+        return;
+    }
+
+    if(fstat(fd, &status) == 0 && status.st_size > 0) {
+        void *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            madvise(data, status.st_size, MADV_SEQUENTIAL);
+            atomic_fetch_add(&line_count, count_matching_lines(data, status.st_size));
+            munmap(data, status.st_size);
+        }
+    }
+
+    close(fd);
+}
+
+static void list_directory(work_item_t *item) {
+    int fd = openat((item->parent != NULL) ? item->parent->fd : AT_FDCWD, item->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(fd == -1) {
+        return;
+    }
+
+    directory_t *directory = malloc(sizeof(directory_t));
+    if(directory == NULL) {
+        close(fd);
+        return;
+    }
+
+    directory->fd = fd;
+    atomic_init(&directory->references, 1);
+
+    char *buffer = malloc(DIRENT_BUFFER_SIZE);
+    ssize_t filled;
+
+    while(buffer != NULL && (filled = getdents64(fd, buffer, DIRENT_BUFFER_SIZE)) > 0) {
+        for(ssize_t offset = 0; offset < filled;) {
+            struct dirent64 *entry = (struct dirent64 *)(buffer + offset);
+            unsigned char type = entry->d_type;
+
+            offset += entry->d_reclen;
+            if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            if(type == DT_UNKNOWN) {
+                struct stat status;
+
+                if(fstatat(fd, entry->d_name, &status, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+
+                type = S_ISDIR(status.st_mode) ? DT_DIR : (S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN);
+            }
+
+            if(type == DT_DIR) {
+                queue_push(directory, entry->d_name, true);
+            } else if(type == DT_REG) {
+                atomic_fetch_add(&file_count, 1);
+                queue_push(directory, entry->d_name, false);
+            }
+        }
+    }
+
+    free(buffer);
+    directory_release(directory);
+}
+
+static void* worker_thread_function(void* thread_param) {
+    work_item_t *item;
+
+    (void)thread_param;
+    while((item = queue_pop()) != NULL) {
+        if(item->is_directory) {
+            list_directory(item);
+        } else {
+            search_file(item);
+        }
+
+        queue_done(item);
+    }
+
+    return NULL;
+}
+
+static void pattern_init(const char *string) {
+    pattern.string = string;
+    pattern.length = strlen(string);
+    pattern.is_regex = pattern.length == 0 || strpbrk(string, ".[]*^$\\\n") != NULL;
+    if(pattern.is_regex && regcomp(&pattern.regex, string, REG_NOSUB) != 0) {
+        printf("Invalid pattern %s\n", string);
+        exit(1);
+    }
+}
+
+int main(int argc, const char** argv) {
+    struct stat status;
+    pthread_t workers[MAX_WORKERS];
+    long worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    long started = 0;
+
+    if(argc != 3) {
+        printf("Expected two arguments, received %d\n", argc - 1);
+        exit(1);
+    }
+
+    if(stat(argv[1], &status) != 0 || !S_ISDIR(status.st_mode)) {
+        printf("Directory %s does not exist\n", argv[1]);
+        exit(1);
+    }
+
+    pattern_init(argv[2]);
+    worker_count = (worker_count < 1) ? 1 : ((worker_count > MAX_WORKERS) ? MAX_WORKERS : worker_count);
+
+    if(!queue_push(NULL, argv[1], true)) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for(; started < worker_count; started++) {
+        if(pthread_create(&workers[started], NULL, worker_thread_function, NULL) != 0) {
+            break;
+        }
+    }
+
+    if(started == 0) {
+        worker_thread_function(NULL);
+    }
+
+    for(long i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    printf("The number of files are %zu and the number of matching lines are %zu\n", atomic_load(&file_count), atomic_load(&line_count));
+
+    return 0;
+}
@@ -103,7 +103,7 @@ make CROSS_COMPILE=${CROSS_COMPILE}
 mkdir -p ${OUTDIR}/rootfs/home
 mkdir -p ${OUTDIR}/rootfs/home/conf
 cp conf/* ${OUTDIR}/rootfs/home/conf
-cp writer finder.sh finder-test.sh autorun-qemu.sh ${OUTDIR}/rootfs/home
+cp writer finder finder.sh finder-test.sh autorun-qemu.sh ${OUTDIR}/rootfs/home
 
 cd ${OUTDIR}
 # TODO: Chown the root directory
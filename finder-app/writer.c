@@ -1,12 +1,425 @@
+#define _GNU_SOURCE // O_DIRECT
 #include <syslog.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
-int main(int argc, const char** argv) {
+#define DEFAULT_BATCH_RECORDS 256
+#define FILE_BUCKETS 4096
+// O_DIRECT transfers must be aligned to the logical block size, 4096 covers every common device
+#define DIRECT_ALIGNMENT 4096
+
+typedef enum {
+    DURABILITY_NONE,
+    DURABILITY_BATCH,
+    DURABILITY_DIRECT,
+} durability_t;
+
+/**
+* A file written in batch mode.  The first record for a path truncates it, every later record
+* is appended, so size is where the next batch continues.
+*/
+typedef struct output_file {
+    char *path;
+    int fd;
+    bool truncated;
+    bool direct;
+    size_t size;
+    /**
+     * O_DIRECT only: the bytes of the last partial block, rewritten with the next batch
+     */
+    char *direct_tail;
+
+    struct iovec *pending;
+    size_t pending_count;
+    size_t pending_capacity;
+
+    struct output_file *next_open;
+    struct output_file *bucket_next;
+} output_file_t;
+
+typedef struct batch_writer {
+    durability_t durability;
+    output_file_t *buckets[FILE_BUCKETS];
+    output_file_t *open_files;
+
+    // Records of the current batch, their content is referenced by the files' pending iovecs
+    char **lines;
+    size_t line_count;
+    size_t line_capacity;
+} batch_writer_t;
+
+static output_file_t *find_file(batch_writer_t *writer, const char *path) {
+    size_t hash = 5381;
+
+    for(const char *c = path; *c != '\0'; c++) {
+        hash = hash * 33 + (unsigned char)*c;
+    }
+
+    output_file_t **bucket = &writer->buckets[hash % FILE_BUCKETS];
+    for(output_file_t *file = *bucket; file != NULL; file = file->bucket_next) {
+        if(strcmp(file->path, path) == 0) {
+            return file;
+        }
+    }
+
+    output_file_t *file = calloc(1, sizeof(output_file_t));
+    if(file == NULL || (file->path = strdup(path)) == NULL) {
+        free(file);
+        return NULL;
+    }
+
+    file->fd = -1;
+    file->direct = writer->durability == DURABILITY_DIRECT;
+    file->bucket_next = *bucket;
+    *bucket = file;
+
+    return file;
+}
+
+static bool open_file(batch_writer_t *writer, output_file_t *file) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (file->truncated ? 0 : O_TRUNC);
+
+    if(file->direct) {
+        file->fd = open(file->path, flags | O_DIRECT, 0644);
+        if(file->fd == -1 && errno == EINVAL) {
+            syslog(LOG_WARNING, "%s does not support O_DIRECT, writing it through the page cache", file->path);
+            file->direct = false;
+        }
+    }
+
+    if(!file->direct) {
+        file->fd = open(file->path, flags, 0644);
+    }
+
+    if(file->fd == -1) {
+        syslog(LOG_ERR, "Error opening file %s: %s", file->path, strerror(errno));
+        return false;
+    }
+
+    file->truncated = true;
+    file->next_open = writer->open_files;
+    writer->open_files = file;
+
+    return true;
+}
+
+static bool add_pending(output_file_t *file, char *data, size_t length) {
+    if(file->pending_count == file->pending_capacity) {
+        size_t capacity = (file->pending_capacity == 0) ? 8 : 2 * file->pending_capacity;
+        struct iovec *pending = realloc(file->pending, capacity * sizeof(struct iovec));
+        if(pending == NULL) {
+            return false;
+        }
+
+        file->pending = pending;
+        file->pending_capacity = capacity;
+    }
+
+    file->pending[file->pending_count++] = (struct iovec){.iov_base = data, .iov_len = length};
+
+    return true;
+}
+
+/**
+* Writes all pending records with as few pwritev calls as IOV_MAX allows
+*/
+static bool write_buffered(output_file_t *file) {
+    struct iovec *vectors = file->pending;
+    size_t remaining = file->pending_count;
+
+    while(remaining > 0) {
+        ssize_t written = pwritev(file->fd, vectors, (remaining < IOV_MAX) ? remaining : IOV_MAX, file->size);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            syslog(LOG_ERR, "Error writing to file %s: %s", file->path, strerror(errno));
+            return false;
+        }
+
+        file->size += written;
+        while(remaining > 0 && (size_t)written >= vectors->iov_len) {
+            written -= vectors->iov_len;
+            vectors++;
+            remaining--;
+        }
+
+        if(remaining > 0) {
+            vectors->iov_base = (char *)vectors->iov_base + written;
+            vectors->iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+/**
+* Gathers the previous partial block and the pending records into one aligned buffer, writes it
+* padded to whole blocks at an aligned offset, then trims the padding off the file.
+*/
+static bool write_direct(output_file_t *file) {
+    size_t start = file->size & ~(size_t)(DIRECT_ALIGNMENT - 1);
+    size_t length = file->size - start;
+    size_t written = 0;
+    char *buffer;
+
+    for(size_t i = 0; i < file->pending_count; i++) {
+        length += file->pending[i].iov_len;
+    }
+
+    size_t padded = (length + DIRECT_ALIGNMENT - 1) & ~(size_t)(DIRECT_ALIGNMENT - 1);
+    if(posix_memalign((void **)&buffer, DIRECT_ALIGNMENT, padded) != 0) {
+        syslog(LOG_ERR, "Error allocating a %zu byte buffer for %s", padded, file->path);
+        return false;
+    }
+
+    size_t filled = file->size - start;
+    if(filled > 0) {
+        memcpy(buffer, file->direct_tail, filled);
+    }
+
+    for(size_t i = 0; i < file->pending_count; i++) {
+        memcpy(buffer + filled, file->pending[i].iov_base, file->pending[i].iov_len);
+        filled += file->pending[i].iov_len;
+    }
+
+    memset(buffer + filled, 0, padded - filled);
+    while(written < padded) {
+        ssize_t result = pwrite(file->fd, buffer + written, padded - written, start + written);
+        if(result < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            syslog(LOG_ERR, "Error writing to file %s: %s", file->path, strerror(errno));
+            free(buffer);
+            return false;
+        }
+
+        written += result;
+    }
+
+    if(ftruncate(file->fd, start + length) != 0) {
+        syslog(LOG_ERR, "Error truncating file %s: %s", file->path, strerror(errno));
+        free(buffer);
+        return false;
+    }
+
+    file->size = start + length;
+    size_t tail = length & (DIRECT_ALIGNMENT - 1);
+    if(tail > 0) {
+        if(file->direct_tail == NULL && (file->direct_tail = malloc(DIRECT_ALIGNMENT)) == NULL) {
+            free(buffer);
+            return false;
+        }
+
+        memcpy(file->direct_tail, buffer + length - tail, tail);
+    }
+
+    free(buffer);
+
+    return true;
+}
+
+/**
+* Writes the pending records of every file opened in this batch, syncs them if the durability
+* asks for it, then closes them.
+*/
+static bool flush_batch(batch_writer_t *writer) {
+    bool success = true;
+
+    while(writer->open_files != NULL) {
+        output_file_t *file = writer->open_files;
+        writer->open_files = file->next_open;
+
+        if(!(file->direct ? write_direct(file) : write_buffered(file))) {
+            success = false;
+        } else if(writer->durability != DURABILITY_NONE && fdatasync(file->fd) != 0) {
+            syslog(LOG_ERR, "Error syncing file %s: %s", file->path, strerror(errno));
+            success = false;
+        }
+
+        if(close(file->fd) != 0) {
+            syslog(LOG_ERR, "Error closing file %s: %s", file->path, strerror(errno));
+            success = false;
+        }
+
+        file->fd = -1;
+        file->pending_count = 0;
+    }
+
+    for(size_t i = 0; i < writer->line_count; i++) {
+        free(writer->lines[i]);
+    }
+    writer->line_count = 0;
+
+    return success;
+}
+
+static void free_files(batch_writer_t *writer) {
+    for(size_t i = 0; i < FILE_BUCKETS; i++) {
+        while(writer->buckets[i] != NULL) {
+            output_file_t *file = writer->buckets[i];
+            writer->buckets[i] = file->bucket_next;
+            free(file->path);
+            free(file->direct_tail);
+            free(file->pending);
+            free(file);
+        }
+    }
+
+    free(writer->lines);
+}
+
+/**
+* Batch mode: writes every "<path>\t<string>" record from the manifest, or stdin, as the single
+* string form would, except that records for the same path are appended to each other.  Records
+* are gathered into batches, so each file is opened and written once per batch.
+*/
+static int write_batch(int argc, char** argv) {
+    batch_writer_t *writer = calloc(1, sizeof(batch_writer_t));
+    size_t batch_records = DEFAULT_BATCH_RECORDS;
+    FILE *manifest = stdin;
+    bool success = true;
+    int option;
+
+    if(writer == NULL) {
+        syslog(LOG_ERR, "Error allocating the batch writer");
+        return 1;
+    }
+
+    optind = 2;
+    while((option = getopt(argc, argv, "i:d:n:")) != -1) {
+        switch(option) {
+        case 'i':
+            if(manifest != stdin) {
+                fclose(manifest);
+            }
+
+            manifest = fopen(optarg, "r");
+            if(manifest == NULL) {
+                syslog(LOG_ERR, "Error opening manifest %s: %s", optarg, strerror(errno));
+                free(writer);
+                return 1;
+            }
+            break;
+        case 'd':
+            if(strcmp(optarg, "none") == 0) {
+                writer->durability = DURABILITY_NONE;
+            } else if(strcmp(optarg, "batch") == 0) {
+                writer->durability = DURABILITY_BATCH;
+            } else if(strcmp(optarg, "direct") == 0) {
+                writer->durability = DURABILITY_DIRECT;
+            } else {
+                syslog(LOG_ERR, "Unknown durability %s, expected none, batch or direct", optarg);
+                success = false;
+            }
+            break;
+        case 'n':
+            batch_records = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            syslog(LOG_ERR, "Expected format: %s -b [-i <Manifest>] [-d none|batch|direct] [-n <Records per batch>]", argv[0]);
+            success = false;
+            break;
+        }
+    }
+
+    writer->line_capacity = (batch_records == 0) ? DEFAULT_BATCH_RECORDS : batch_records;
+    writer->lines = malloc(writer->line_capacity * sizeof(char *));
+    if(writer->lines == NULL) {
+        syslog(LOG_ERR, "Error allocating a batch of %zu records", writer->line_capacity);
+        success = false;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length;
+
+    while(success && (line_length = getline(&line, &line_size, manifest)) != -1) {
+        char *separator = memchr(line, '\t', line_length);
+        if(separator == NULL) {
+            syslog(LOG_ERR, "Expected <File Name>\\t<String to Write>, got %s", line);
+            success = false;
+            break;
+        }
+
+        // Every record ends in a newline, like the string written by the single string form
+        if(line[line_length - 1] != '\n') {
+            if((size_t)line_length + 1 >= line_size) {
+                char *grown = realloc(line, line_length + 2);
+                if(grown == NULL) {
+                    success = false;
+                    break;
+                }
+
+                line = grown;
+                line_size = line_length + 2;
+            }
+
+            line[line_length++] = '\n';
+            line[line_length] = '\0';
+        }
+
+        *separator = '\0';
+        output_file_t *file = find_file(writer, line);
+        if(file == NULL) {
+            syslog(LOG_ERR, "Error allocating state for file %s", line);
+            success = false;
+            break;
+        }
+
+        if(file->fd == -1 && !open_file(writer, file)) {
+            success = false;
+            break;
+        }
+
+        if(!add_pending(file, separator + 1, line + line_length - separator - 1)) {
+            success = false;
+            break;
+        }
+
+        // The record's content stays referenced until the batch is written
+        writer->lines[writer->line_count++] = line;
+        line = NULL;
+        line_size = 0;
+
+        if(writer->line_count == writer->line_capacity && !flush_batch(writer)) {
+            success = false;
+        }
+    }
+
+    free(line);
+    if(writer->lines != NULL && !flush_batch(writer)) {
+        success = false;
+    }
+
+    free_files(writer);
+    free(writer);
+    if(manifest != stdin) {
+        fclose(manifest);
+    }
+
+    return success ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
     openlog(NULL, 0, LOG_USER);
 
+    if(argc > 1 && strcmp(argv[1], "-b") == 0) {
+        int result = write_batch(argc, argv);
+        closelog();
+        return result;
+    }
+
     if(argc < 3 && argc > 0) {
         syslog(LOG_ERR, "Expected format: %s <File Name> <String to Write>", argv[0]);
         closelog();
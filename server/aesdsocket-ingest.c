@@ -0,0 +1,131 @@
+/**
+ * @file aesdsocket-ingest.c
+ * @brief Appends packets to a local aesdsocket through its shared memory ingest ring
+ *
+ * Each line of standard input, newline included, is appended as one packet, the same as a
+ * client sending it over TCP but without the connection or the history reply.  With -b it
+ * instead appends the given number of copies of a test line and reports the time per append,
+ * which stays well under a microsecond while the server keeps up.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ingest_ring.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Appends one packet, waiting for the server to drain the ring while it is full
+ * @param full_count counts the appends that found the ring full
+ * @return 0 on success, -1 on failure
+ */
+static int append_packet(IngestRing *ring, const char *packet, size_t length, uint64_t *full_count)
+{
+    const struct timespec backoff = {.tv_nsec = 50000};
+    bool counted = false;
+
+    while (ingest_ring_append(ring, packet, length) == -1)
+    {
+        if (errno != EAGAIN)
+        {
+            perror("ingest_ring_append");
+            return -1;
+        }
+
+        if (!counted)
+        {
+            ++*full_count;
+            counted = true;
+        }
+
+        nanosleep(&backoff, NULL);
+    }
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s socket] [-b appends]\n", name);
+    fprintf(stderr, "Appends every line of standard input, or with -b that many test lines, through %s by default\n", INGEST_SOCKET_PATH);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socket_path = INGEST_SOCKET_PATH;
+    unsigned long benchmark_appends = 0;
+    uint64_t full_count = 0;
+    IngestRing ring;
+    int result = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:b:h")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'b':
+            benchmark_appends = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (ingest_ring_connect(&ring, socket_path) == -1)
+    {
+        perror(socket_path);
+        return 1;
+    }
+
+    if (benchmark_appends > 0)
+    {
+        char packet[64];
+        int length = snprintf(packet, sizeof(packet), "ingest benchmark from %d\n", (int)getpid());
+        uint64_t start = now_ns();
+        uint64_t elapsed;
+
+        for (unsigned long i = 0; i < benchmark_appends && result == 0; ++i)
+        {
+            result = append_packet(&ring, packet, length, &full_count);
+        }
+
+        elapsed = now_ns() - start;
+        fprintf(stderr, "%lu appends of %d bytes, %.1f ns per append, %llu found the ring full\n", benchmark_appends, length,
+                (double)elapsed / benchmark_appends, (unsigned long long)full_count);
+    }
+    else
+    {
+        char *line = NULL;
+        size_t capacity = 0;
+        ssize_t length;
+
+        while (result == 0 && (length = getline(&line, &capacity, stdin)) != -1)
+        {
+            result = append_packet(&ring, line, length, &full_count);
+        }
+
+        free(line);
+    }
+
+    ingest_ring_close(&ring);
+
+    return (result == 0) ? 0 : 1;
+}
@@ -0,0 +1,570 @@
+/**
+ * @file aesdsocket-soak.c
+ * @brief Long running load and resource tracking for aesdsocket
+ *
+ * Starts aesdsocket in the foreground, or attaches to a running one, and keeps a number of
+ * clients sending one packet per connection and reading the history reply for the requested
+ * time.  Once per second it samples the server's RSS, open descriptors and thread count from
+ * /proc along with the requests, reply bytes and latency of that second, and writes them as a
+ * CSV row.  The summary compares the start and end of the run and flags resources that keep
+ * growing and latency that does, with exit status 1 if anything was flagged.
+ *
+ * Build aesdsocket with make for /dev/aesdchar, which needs the driver loaded, or with
+ * make file-backend for /var/tmp/aesdsocketdata.
+ */
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 256
+#define LATENCY_BUCKETS 40
+#define RECEIVE_BUFFER_SIZE 65536
+
+typedef struct SecondCounters
+{
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t reply_bytes;
+    atomic_uint_fast64_t latency_ns;
+    atomic_uint_fast64_t max_latency_ns;
+    /**
+     * Bucket n counts requests that took less than 2^n nanoseconds
+     */
+    atomic_uint_fast64_t latency_bucket[LATENCY_BUCKETS];
+} SecondCounters;
+
+typedef struct Sample
+{
+    unsigned int second;
+    long rss_kib;
+    long descriptors;
+    long threads;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t reply_bytes;
+    double mean_latency_us;
+    double p99_latency_us;
+    double max_latency_us;
+} Sample;
+
+typedef struct SoakClient
+{
+    pthread_t thread;
+    unsigned int id;
+} SoakClient;
+
+static struct sockaddr_in server_address;
+static SecondCounters counters;
+static atomic_bool should_stop;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Sends one packet and reads the reply until the server closes the connection
+ * @return the reply length, or -1 on failure
+ */
+static ssize_t run_request(unsigned int client, uint64_t sequence, char *buffer)
+{
+    int descriptor = socket(AF_INET, SOCK_STREAM, 0);
+    ssize_t total = 0;
+    ssize_t received;
+    int length;
+
+    if (descriptor == -1)
+    {
+        return -1;
+    }
+
+    if (connect(descriptor, (struct sockaddr *)&server_address, sizeof(server_address)) == -1)
+    {
+        close(descriptor);
+        return -1;
+    }
+
+    length = snprintf(buffer, RECEIVE_BUFFER_SIZE, "soak client %u request %llu\n", client, (unsigned long long)sequence);
+    if (send(descriptor, buffer, length, MSG_NOSIGNAL) != length)
+    {
+        close(descriptor);
+        return -1;
+    }
+
+    while ((received = recv(descriptor, buffer, RECEIVE_BUFFER_SIZE, 0)) > 0)
+    {
+        total += received;
+    }
+
+    close(descriptor);
+
+    return (received == 0) ? total : -1;
+}
+
+static void *client_thread_function(void *thread_arguments)
+{
+    SoakClient *client = (SoakClient *)thread_arguments;
+    char *buffer = malloc(RECEIVE_BUFFER_SIZE);
+    uint64_t sequence = 0;
+
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+
+    while (!atomic_load(&should_stop))
+    {
+        uint64_t start = now_ns();
+        ssize_t reply = run_request(client->id, sequence++, buffer);
+        uint64_t elapsed = now_ns() - start;
+        size_t bucket = (elapsed == 0) ? 0 : 64 - __builtin_clzll(elapsed);
+
+        if (reply < 0)
+        {
+            atomic_fetch_add(&counters.errors, 1);
+            // Do not spin while the server is down
+            usleep(10000);
+            continue;
+        }
+
+        atomic_fetch_add(&counters.requests, 1);
+        atomic_fetch_add(&counters.reply_bytes, reply);
+        atomic_fetch_add(&counters.latency_ns, elapsed);
+        atomic_fetch_add(&counters.latency_bucket[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1], 1);
+        for (uint64_t max = atomic_load(&counters.max_latency_ns); elapsed > max;)
+        {
+            if (atomic_compare_exchange_weak(&counters.max_latency_ns, &max, elapsed))
+            {
+                break;
+            }
+        }
+    }
+
+    free(buffer);
+
+    return NULL;
+}
+
+/**
+ * @return the value of the "@param key:" line of /proc/@param pid/status, or -1
+ */
+static long read_status_field(pid_t pid, const char *key)
+{
+    char path[64];
+    char line[256];
+    size_t key_length = strlen(key);
+    long value = -1;
+    FILE *status;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    status = fopen(path, "r");
+    if (status == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, key, key_length) == 0 && line[key_length] == ':')
+        {
+            value = strtol(line + key_length + 1, NULL, 10);
+            break;
+        }
+    }
+
+    fclose(status);
+
+    return value;
+}
+
+static long count_descriptors(pid_t pid)
+{
+    char path[64];
+    struct dirent *entry;
+    long count = 0;
+    DIR *directory;
+
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    directory = opendir(path);
+    if (directory == NULL)
+    {
+        return -1;
+    }
+
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            ++count;
+        }
+    }
+
+    closedir(directory);
+
+    return count;
+}
+
+/**
+ * Takes this second's counters, resetting them for the next one
+ */
+static void take_sample(pid_t pid, unsigned int second, Sample *sample)
+{
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t latency_ns = atomic_exchange(&counters.latency_ns, 0);
+    uint64_t seen = 0;
+
+    sample->second = second;
+    sample->rss_kib = read_status_field(pid, "VmRSS");
+    sample->threads = read_status_field(pid, "Threads");
+    sample->descriptors = count_descriptors(pid);
+    sample->requests = atomic_exchange(&counters.requests, 0);
+    sample->errors = atomic_exchange(&counters.errors, 0);
+    sample->reply_bytes = atomic_exchange(&counters.reply_bytes, 0);
+    sample->max_latency_us = atomic_exchange(&counters.max_latency_ns, 0) / 1e3;
+    sample->mean_latency_us = (sample->requests == 0) ? 0.0 : latency_ns / 1e3 / sample->requests;
+    sample->p99_latency_us = 0.0;
+
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        buckets[i] = atomic_exchange(&counters.latency_bucket[i], 0);
+    }
+
+    // Reported as the upper bound of the bucket holding the 99th percentile, which the slowest
+    // request bounds more tightly when it falls in that bucket
+    for (size_t i = 0; i < LATENCY_BUCKETS && sample->requests > 0; ++i)
+    {
+        seen += buckets[i];
+        if (seen * 100 >= sample->requests * 99)
+        {
+            sample->p99_latency_us = (double)(1ULL << i) / 1e3;
+            break;
+        }
+    }
+
+    if (sample->p99_latency_us > sample->max_latency_us)
+    {
+        sample->p99_latency_us = sample->max_latency_us;
+    }
+}
+
+static bool wait_for_server(unsigned int timeout_seconds)
+{
+    char buffer[1];
+
+    for (unsigned int attempt = 0; attempt < timeout_seconds * 10; ++attempt)
+    {
+        int descriptor = socket(AF_INET, SOCK_STREAM, 0);
+        bool connected = descriptor != -1 && connect(descriptor, (struct sockaddr *)&server_address, sizeof(server_address)) == 0;
+
+        if (descriptor != -1)
+        {
+            // An empty connection makes the server reply with the history, which is fine
+            if (connected)
+            {
+                shutdown(descriptor, SHUT_WR);
+                while (recv(descriptor, buffer, sizeof(buffer), 0) > 0)
+                {
+                }
+            }
+
+            close(descriptor);
+        }
+
+        if (connected)
+        {
+            return true;
+        }
+
+        usleep(100000);
+    }
+
+    return false;
+}
+
+typedef enum SoakMetric
+{
+    METRIC_RSS,
+    METRIC_DESCRIPTORS,
+    METRIC_THREADS,
+    METRIC_MEAN_LATENCY,
+    METRIC_P99_LATENCY,
+    METRIC_THROUGHPUT,
+    METRIC_COUNT,
+} SoakMetric;
+
+static const char *const metric_names[METRIC_COUNT] = {"rss_kib", "descriptors", "threads", "mean_latency_us", "p99_latency_us", "requests_per_s"};
+
+static double metric_value(const Sample *sample, SoakMetric metric)
+{
+    switch (metric)
+    {
+    case METRIC_RSS:
+        return sample->rss_kib;
+    case METRIC_DESCRIPTORS:
+        return sample->descriptors;
+    case METRIC_THREADS:
+        return sample->threads;
+    case METRIC_MEAN_LATENCY:
+        return sample->mean_latency_us;
+    case METRIC_P99_LATENCY:
+        return sample->p99_latency_us;
+    default:
+        return sample->requests;
+    }
+}
+
+static double metric_mean(const Sample *samples, size_t first, size_t last, SoakMetric metric)
+{
+    double sum = 0.0;
+
+    for (size_t s = first; s < last; ++s)
+    {
+        sum += metric_value(&samples[s], metric);
+    }
+
+    return (last > first) ? sum / (last - first) : 0.0;
+}
+
+/**
+ * Compares the first and last tenth of the run, after skipping a warmup tenth.  Descriptors
+ * and threads are small counts, so they are flagged when they grow by more than a couple, the
+ * rest when they change by more than @param growth_threshold percent.
+ * @return the number of metrics flagged
+ */
+static int summarize(const Sample *samples, size_t count, double growth_threshold)
+{
+    size_t window = count / 10;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    int flagged = 0;
+
+    for (size_t s = 0; s < count; ++s)
+    {
+        requests += samples[s].requests;
+        errors += samples[s].errors;
+    }
+
+    fprintf(stderr, "\nsoak summary: %zu seconds, %llu requests (%.1f/s), %llu errors\n", count,
+            (unsigned long long)requests, (count == 0) ? 0.0 : (double)requests / count, (unsigned long long)errors);
+
+    if (window == 0)
+    {
+        fprintf(stderr, "run for at least 20 seconds to compare the start and end of the run\n");
+        return 0;
+    }
+
+    for (int metric = 0; metric < METRIC_COUNT; ++metric)
+    {
+        double early = metric_mean(samples, window, 2 * window, metric);
+        double late = metric_mean(samples, count - window, count, metric);
+        const char *verdict = "ok";
+
+        if (metric == METRIC_DESCRIPTORS || metric == METRIC_THREADS)
+        {
+            verdict = (late - early > 2.0) ? "GREW" : verdict;
+        }
+        else if (metric == METRIC_THROUGHPUT)
+        {
+            verdict = (late < early * (1.0 - growth_threshold / 100.0)) ? "DROPPED" : verdict;
+        }
+        else
+        {
+            verdict = (late > early * (1.0 + growth_threshold / 100.0)) ? "GREW" : verdict;
+        }
+
+        fprintf(stderr, "%-16s start %12.1f  end %12.1f  %s\n", metric_names[metric], early, late, verdict);
+        flagged += strcmp(verdict, "ok") != 0;
+    }
+
+    return flagged;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-x aesdsocket | -P pid] [-c clients, at most %d] [-d seconds] [-o csv] [-p port] [-g growth percent]\n",
+            name, MAX_CLIENTS);
+    fprintf(stderr, "Defaults: -x ./aesdsocket -c 8 -d 60 -o stdout -p 9000 -g 50\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server_path = "./aesdsocket";
+    const char *csv_path = NULL;
+    unsigned int client_count = 8;
+    unsigned int duration = 60;
+    unsigned int port = 9000;
+    double growth_threshold = 50.0;
+    SoakClient clients[MAX_CLIENTS];
+    unsigned int started = 0;
+    Sample *samples;
+    size_t sample_count = 0;
+    pid_t pid = 0;
+    bool attached = false;
+    FILE *csv = stdout;
+    int result = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "x:P:c:d:o:p:g:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'x':
+            server_path = optarg;
+            break;
+        case 'P':
+            pid = strtol(optarg, NULL, 10);
+            attached = true;
+            break;
+        case 'c':
+            client_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            duration = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            csv_path = optarg;
+            break;
+        case 'p':
+            port = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            growth_threshold = strtod(optarg, NULL);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (client_count == 0 || client_count > MAX_CLIENTS || duration == 0 || (attached && pid <= 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    samples = calloc(duration, sizeof(Sample));
+    if (samples == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    if (csv_path != NULL && (csv = fopen(csv_path, "w")) == NULL)
+    {
+        perror(csv_path);
+        free(samples);
+        return 1;
+    }
+
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (!attached)
+    {
+        pid = fork();
+        if (pid == -1)
+        {
+            perror("fork");
+            result = 1;
+            goto start_failed;
+        }
+
+        if (pid == 0)
+        {
+            char port_argument[8];
+
+            snprintf(port_argument, sizeof(port_argument), "%u", port);
+            execl(server_path, server_path, "-p", port_argument, (char *)NULL);
+            perror(server_path);
+            _exit(127);
+        }
+    }
+
+    if (!wait_for_server(10))
+    {
+        fprintf(stderr, "aesdsocket did not accept connections on port %u\n", port);
+        result = 1;
+        goto server_failed;
+    }
+
+    for (; started < client_count; ++started)
+    {
+        clients[started].id = started;
+        if (pthread_create(&clients[started].thread, NULL, client_thread_function, &clients[started]) != 0)
+        {
+            perror("pthread_create");
+            break;
+        }
+    }
+
+    fprintf(csv, "second,rss_kib,descriptors,threads,requests,errors,reply_bytes,mean_latency_us,p99_latency_us,max_latency_us\n");
+    for (uint64_t next = now_ns() + 1000000000ULL; sample_count < duration; next += 1000000000ULL)
+    {
+        struct timespec deadline = {.tv_sec = next / 1000000000ULL, .tv_nsec = next % 1000000000ULL};
+        Sample *sample = &samples[sample_count];
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        {
+        }
+
+        take_sample(pid, sample_count + 1, sample);
+        if (sample->rss_kib < 0)
+        {
+            fprintf(stderr, "aesdsocket exited after %zu seconds\n", sample_count);
+            result = 1;
+            break;
+        }
+
+        fprintf(csv, "%u,%ld,%ld,%ld,%llu,%llu,%llu,%.1f,%.1f,%.1f\n", sample->second, sample->rss_kib, sample->descriptors,
+                sample->threads, (unsigned long long)sample->requests, (unsigned long long)sample->errors,
+                (unsigned long long)sample->reply_bytes, sample->mean_latency_us, sample->p99_latency_us, sample->max_latency_us);
+        fflush(csv);
+        ++sample_count;
+    }
+
+    atomic_store(&should_stop, true);
+    for (unsigned int i = 0; i < started; ++i)
+    {
+        pthread_join(clients[i].thread, NULL);
+    }
+
+    if (summarize(samples, sample_count, growth_threshold) != 0)
+    {
+        result = 1;
+    }
+
+server_failed:
+    if (!attached)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+start_failed:
+    if (csv != stdout)
+    {
+        fclose(csv);
+    }
+
+    free(samples);
+
+    return result;
+}
@@ -1,3 +1,4 @@
+#include <getopt.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,18 +7,25 @@
 #include <syslog.h>
 #include <unistd.h>
 
+#include "../common/lock_profiler.h"
 #include "connection_info.h"
+#include "ingest_server.h"
+#include "replication.h"
 #include "timestamp_writer.h"
+#include "trace_probes.h"
 
 int *server_descriptor = NULL;
 struct sockaddr_in *server_address = NULL;
 
 pthread_mutex_t *output_file_mutex = NULL;
+const char *output_file_path = DEFAULT_OUTPUT_FILE_PATH;
 
 #if !USE_AESD_CHAR_DEVICE
 TimestampWriterThread *timestamp_writer_thread = NULL;
 #endif
 
+IngestServerThread *ingest_server_thread = NULL;
+
 ConnectionListHead *head = NULL;
 
 pthread_t main_thread = 0;
@@ -46,6 +54,16 @@ void handle_incoming_signal(int signal)
         free(head);
     }
 
+    replication_stop();
+
+    if (ingest_server_thread != NULL)
+    {
+        ingest_server_request_close(&ingest_server_thread->thread_arguments);
+        pthread_join(ingest_server_thread->thread, NULL);
+        ingest_server_cleanup(&ingest_server_thread->thread_arguments);
+        free(ingest_server_thread);
+    }
+
 #if !USE_AESD_CHAR_DEVICE
     if (timestamp_writer_thread != NULL)
     {
@@ -76,24 +94,97 @@ void handle_incoming_signal(int signal)
 
     closelog();
 #if !USE_AESD_CHAR_DEVICE
-    remove("/var/tmp/aesdsocketdata");
+    remove(output_file_path);
 #endif
 
     exit(0);
 }
 
+/**
+ * Starts accepting ingest producers on @param socket_path
+ * @return the running thread, or NULL if it could not start, which only leaves ingest off
+ */
+static IngestServerThread *ingest_server_start(const char *socket_path)
+{
+    IngestServerThread *thread = (IngestServerThread *)malloc(sizeof(IngestServerThread));
+    if (thread == NULL)
+    {
+        perror("malloc");
+        goto thread_malloc_failed;
+    }
+
+    if (ingest_server_init(&thread->thread_arguments, output_file_mutex, output_file_path, socket_path) != 0)
+    {
+        goto init_failed;
+    }
+
+    if (pthread_create(&thread->thread, NULL, ingest_server_thread_function, (void *)&thread->thread_arguments) != 0)
+    {
+        perror("pthread_create");
+        goto thread_create_failed;
+    }
+
+    return thread;
+
+thread_create_failed:
+    ingest_server_cleanup(&thread->thread_arguments);
+init_failed:
+    free(thread);
+thread_malloc_failed:
+    fprintf(stderr, "Continuing without the ingest socket %s\n", socket_path);
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
+    bool run_as_daemon = false;
+    unsigned short port = 9000;
+    unsigned short replication_port = 0;
+    const char *leader = NULL;
+    const char *ingest_socket_path = NULL;
+    int option;
+
     main_thread = pthread_self();
 
-    if (argc == 2 && strncmp(argv[1], "-d", 2) != 0)
+    // -L serves followers on the given port, -F follows the leader at host:port, -I accepts
+    // shared memory ingest producers on the given unix socket
+    while ((option = getopt(argc, argv, "dp:f:L:F:I:")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            run_as_daemon = true;
+            break;
+        case 'p':
+            port = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            output_file_path = optarg;
+            break;
+        case 'L':
+            replication_port = strtoul(optarg, NULL, 10);
+            break;
+        case 'F':
+            leader = optarg;
+            break;
+        case 'I':
+            ingest_socket_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d] [-p port] [-f storage] [-L replication port | -F leader host:port] [-I ingest socket]\n", argv[0]);
+            goto invalid_arguments;
+        }
+    }
+
+    if (optind < argc)
     {
-        fprintf(stderr, "Expected -d argument, got %s", argv[1]);
+        fprintf(stderr, "Unexpected argument %s\n", argv[optind]);
         goto invalid_arguments;
     }
-    else if (argc > 2)
+
+    if (replication_port != 0 && leader != NULL)
     {
-        fprintf(stderr, "Too many arguments: Expected 2, got %d", argc);
+        fprintf(stderr, "An instance cannot both lead and follow\n");
         goto invalid_arguments;
     }
 
@@ -128,7 +219,7 @@ int main(int argc, char *argv[])
     memset(server_address, 0, sizeof(struct sockaddr_in));
     server_address->sin_addr.s_addr = htonl(INADDR_ANY);
     server_address->sin_family = AF_INET;
-    server_address->sin_port = htons(9000);
+    server_address->sin_port = htons(port);
 
     const int enable = 1;
     if (setsockopt(*server_descriptor, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) == -1)
@@ -143,7 +234,7 @@ int main(int argc, char *argv[])
         goto bind_failed;
     }
 
-    if (argc == 2)
+    if (run_as_daemon)
     {
         fprintf(stderr, "\nCreating daemon\n");
         if (daemon(1, 1) != 0)
@@ -172,6 +263,24 @@ int main(int argc, char *argv[])
         goto output_file_mutex_init_failed;
     }
 
+    profiled_mutex_name(output_file_mutex, "output_file_mutex");
+
+    // Followers only store what the leader sends, so the local writers stay off
+    if (leader != NULL)
+    {
+        if (replication_follower_start(leader, output_file_mutex, output_file_path) != 0)
+        {
+            goto replication_start_failed;
+        }
+
+        goto local_writers_skipped;
+    }
+
+    if (replication_port != 0 && replication_leader_start(replication_port, output_file_mutex, output_file_path) != 0)
+    {
+        goto replication_start_failed;
+    }
+
 #if !USE_AESD_CHAR_DEVICE
     timestamp_writer_thread = (TimestampWriterThread *)malloc(sizeof(TimestampWriterThread));
     if (timestamp_writer_thread == NULL)
@@ -181,8 +290,8 @@ int main(int argc, char *argv[])
     }
 
     atomic_store(&timestamp_writer_thread->thread_arguments.should_close, false);
-    timestamp_writer_thread->thread_arguments.output_file = output_file;
     timestamp_writer_thread->thread_arguments.output_file_mutex = output_file_mutex;
+    timestamp_writer_thread->thread_arguments.output_file_path = output_file_path;
     if (pthread_create(&timestamp_writer_thread->thread, NULL, timestamp_writer_thread_function, (void *)&timestamp_writer_thread->thread_arguments) != 0)
     {
         perror("pthread_create");
@@ -190,6 +299,12 @@ int main(int argc, char *argv[])
     }
 #endif
 
+    if (ingest_socket_path != NULL)
+    {
+        ingest_server_thread = ingest_server_start(ingest_socket_path);
+    }
+
+local_writers_skipped:
     openlog(NULL, 0, LOG_USER);
 
     head = (ConnectionListHead *)malloc(sizeof(ConnectionListHead));
@@ -222,8 +337,10 @@ int main(int argc, char *argv[])
             goto error_in_loop;
         }
 
+        trace_probe(accept, connection_thread->connection_info.client_descriptor, ntohl(connection_thread->connection_info.client_address.sin_addr.s_addr));
         syslog(LOG_NOTICE, "Accepted connection from %s", inet_ntoa(connection_thread->connection_info.client_address.sin_addr));
         connection_thread->connection_info.output_file_mutex = output_file_mutex;
+        connection_thread->connection_info.output_file_path = output_file_path;
 
         if (pthread_create(&connection_thread->thread, NULL, connection_thread_function, (void *)&connection_thread->connection_info) != 0)
         {
@@ -242,7 +359,7 @@ int main(int argc, char *argv[])
             if (atomic_load(&next_connection->connection_info.thread_complete))
             {
                 SLIST_REMOVE(head, next_connection, ConnectionThread, next);
-                if (pthread_join(iter->thread, NULL))
+                if (pthread_join(next_connection->thread, NULL))
                 {
                     // log error and continue
                     perror("pthread_join");
@@ -272,7 +389,21 @@ error_in_loop:
 
     free(head);
 connection_list_head_malloc_failed:
+    if (ingest_server_thread != NULL)
+    {
+        ingest_server_request_close(&ingest_server_thread->thread_arguments);
+        pthread_join(ingest_server_thread->thread, NULL);
+        ingest_server_cleanup(&ingest_server_thread->thread_arguments);
+        free(ingest_server_thread);
+    }
+
 #if !USE_AESD_CHAR_DEVICE
+    // Followers never start it
+    if (timestamp_writer_thread == NULL)
+    {
+        goto timestamp_writer_thread_malloc_failed;
+    }
+
     atomic_store(&timestamp_writer_thread->thread_arguments.should_close, true);
     pthread_kill(timestamp_writer_thread->thread, SIGINT);
     pthread_join(timestamp_writer_thread->thread, NULL);
@@ -280,6 +411,8 @@ timestamp_writer_thread_create_failed:
     free(timestamp_writer_thread);
 timestamp_writer_thread_malloc_failed:
 #endif
+    replication_stop();
+replication_start_failed:
     pthread_mutex_destroy(output_file_mutex);
     closelog();
 output_file_mutex_init_failed:
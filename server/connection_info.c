@@ -7,6 +7,114 @@
 #include <unistd.h>
 
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "../aesd-char-driver/aesd-newline-scan.h"
+#include "../common/lock_profiler.h"
+#include "replication.h"
+#include "trace_probes.h"
+
+#define SEEKTO_COMMAND "AESDCHAR_IOCSEEKTO:"
+#define SEEKTO_PACKET_LENGTH 23
+#define READ_FROM_COMMAND "AESDSOCKET_READ_FROM:"
+#define READ_FROM_UNAVAILABLE_REPLY "AESDSOCKET_READ_FROM_UNAVAILABLE:%llu\n"
+
+typedef struct PendingReply
+{
+    // Where the history is read back from, or -1 to keep the position a seek command set
+    long position;
+    // Replaces the history with the replication status
+    bool replication_status;
+    // Replaces the history with an error for a read from offset the storage does not hold
+    bool offset_unavailable;
+    uint64_t offset;
+} PendingReply;
+
+/**
+ * @return whether @param packet is a read from command, with the replication offset it asks for
+ * in @param offset
+ */
+static bool parse_read_from(const char *packet, size_t length, uint64_t *offset)
+{
+    size_t digits_start = strlen(READ_FROM_COMMAND);
+
+    if (length < digits_start + 2 || packet[length - 1] != '\n' || strncmp(packet, READ_FROM_COMMAND, digits_start) != 0)
+    {
+        return false;
+    }
+
+    *offset = 0;
+    for (size_t i = digits_start; i < length - 1; ++i)
+    {
+        if (packet[i] < '0' || packet[i] > '9')
+        {
+            return false;
+        }
+
+        *offset = *offset * 10 + (packet[i] - '0');
+    }
+
+    return true;
+}
+
+/**
+ * Writes one packet to @param output_file, or applies it if it is a command.  A seek command
+ * goes to the driver with ioctl, a read from command asks for the history from a replication
+ * offset, or an error naming the offset if the storage does not hold it, and the status command
+ * for the replication status instead of the history.
+ * Each packet is flushed separately so the driver commits it as its own entry.  Followers are
+ * read only and do not store packets.
+ * @param reply is updated by commands that change what the reply holds
+ * @return 0 on success, -1 on failure
+ */
+static int handle_packet(ConnectionInfo *connection_info, FILE *output_file, const char *packet, size_t length, PendingReply *reply)
+{
+    uint64_t offset;
+
+    if (length == SEEKTO_PACKET_LENGTH && strncmp(packet, SEEKTO_COMMAND, strlen(SEEKTO_COMMAND)) == 0)
+    {
+        AesdSeekTo seek_to = {
+            .write_cmd = packet[19] - '0',
+            .write_cmd_offset = packet[21] - '0',
+        };
+
+        trace_probe(seek, connection_info->client_descriptor, seek_to.write_cmd, seek_to.write_cmd_offset);
+        ioctl(fileno(output_file), AESDCHAR_IOCSEEKTO, &seek_to);
+        reply->position = -1;
+        reply->offset_unavailable = false;
+        return 0;
+    }
+
+    if (parse_read_from(packet, length, &offset))
+    {
+        long storage_size = (fseek(output_file, 0, SEEK_END) == 0) ? ftell(output_file) : -1;
+
+        reply->position = replication_storage_position(offset, storage_size);
+        reply->offset_unavailable = reply->position < 0;
+        reply->offset = offset;
+        return 0;
+    }
+
+    if (length == strlen(REPLICATION_STATUS_COMMAND) && strncmp(packet, REPLICATION_STATUS_COMMAND, length) == 0)
+    {
+        reply->replication_status = true;
+        return 0;
+    }
+
+    if (replication_is_follower())
+    {
+        return 0;
+    }
+
+    if (fwrite(packet, 1, length, output_file) != length || fflush(output_file) != 0)
+    {
+        fprintf(stderr, "failed to write to file: %.*s", (int)length, packet);
+        return -1;
+    }
+
+    replication_publish(packet, length);
+    trace_probe(append, connection_info->client_descriptor, length);
+
+    return 0;
+}
 
 void *connection_thread_function(void *thread_arguments)
 {
@@ -15,26 +123,28 @@ void *connection_thread_function(void *thread_arguments)
 
     ssize_t received_bytes = 0;
     memset(connection_info->message_buffer, 0, sizeof(connection_info->message_buffer));
-    if (pthread_mutex_lock(connection_info->output_file_mutex) != 0)
+    trace_probe(mutex_wait, connection_info->output_file_mutex, connection_info->client_descriptor);
+    if (profiled_mutex_lock(connection_info->output_file_mutex) != 0)
     {
         fprintf(stderr, "Failed to lock output file mutex: %s, %d", __FILE__, __LINE__);
         goto output_file_mutex_lock_failed;
     }
 
-#if USE_AESD_CHAR_DEVICE
-    output_file = fopen("/dev/aesdchar", "a+");
-#else
-    output_file = fopen("/var/tmp/aesdsocketdata", "a+");
-#endif
+    trace_probe(mutex_acquired, connection_info->output_file_mutex, connection_info->client_descriptor);
+
+    output_file = fopen(connection_info->output_file_path, "a+");
     if (output_file == NULL)
     {
         perror("fopen");
         goto fopen_failed;
     }
 
-    bool go_to_beginning = true;
+    PendingReply reply = {.position = 0, .replication_status = false, .offset_unavailable = false};
+    bool packet_complete = false;
+    size_t packet_bytes = 0;
+    size_t reply_bytes = 0;
 
-    while (strchr(connection_info->message_buffer, '\n') == NULL)
+    while (!packet_complete)
     {
         received_bytes = recv(connection_info->client_descriptor, connection_info->message_buffer, sizeof(connection_info->message_buffer) - 1, 0);
         if (received_bytes == -1)
@@ -43,51 +153,102 @@ void *connection_thread_function(void *thread_arguments)
             goto early_return;
         }
 
-        connection_info->message_buffer[received_bytes] = '\0';
+        if (received_bytes == 0)
+        {
+            goto early_return;
+        }
+
+        trace_probe(recv, connection_info->client_descriptor, received_bytes);
+        packet_bytes += received_bytes;
 
-        if (strncmp(connection_info->message_buffer, "AESDCHAR_IOCSEEKTO:", 19) == 0 && strlen(connection_info->message_buffer) == 23)
+        // A single recv can hold several packets, split it at every newline
+        size_t packet_length = 0;
+        for (size_t packet_start = 0; packet_start < (size_t)received_bytes; packet_start += packet_length)
         {
-            int file_descriptor = fileno(output_file);
-            AesdSeekTo seek_to = {
-                .write_cmd = connection_info->message_buffer[19] - '0',
-                .write_cmd_offset = connection_info->message_buffer[21] - '0',
-            };
-
-            ioctl(file_descriptor, AESDCHAR_IOCSEEKTO, &seek_to);
-            go_to_beginning = false;
+            const char *packet = connection_info->message_buffer + packet_start;
+            size_t remaining = received_bytes - packet_start;
+
+            packet_length = aesd_newline_find(packet, remaining);
+            if (packet_length < remaining)
+            {
+                ++packet_length;
+                packet_complete = true;
+            }
+
+            if (handle_packet(connection_info, output_file, packet, packet_length, &reply) != 0)
+            {
+                goto early_return;
+            }
         }
-        else if (fprintf(output_file, "%s", connection_info->message_buffer) == -1)
+    }
+
+    trace_probe(packet_complete, connection_info->client_descriptor, packet_bytes);
+
+    if (reply.position >= 0)
+    {
+        fseek(output_file, reply.position, SEEK_SET);
+    }
+
+    memset(connection_info->message_buffer, 0, sizeof(connection_info->message_buffer));
+    trace_probe(reply_begin, connection_info->client_descriptor);
+    if (reply.replication_status)
+    {
+        char status[4096];
+        size_t status_length = replication_format_status(status, sizeof(status));
+
+        if (send(connection_info->client_descriptor, status, status_length, MSG_NOSIGNAL) == -1)
         {
-            fprintf(stderr, "failed to write to file: %s", connection_info->message_buffer);
+            perror("send");
             goto early_return;
         }
+
+        reply_bytes = status_length;
+        goto reply_sent;
     }
 
-    if (go_to_beginning)
+    if (reply.offset_unavailable)
     {
-        fseek(output_file, 0, SEEK_SET);
+        char error[64];
+        int error_length = snprintf(error, sizeof(error), READ_FROM_UNAVAILABLE_REPLY, (unsigned long long)reply.offset);
+
+        if (send(connection_info->client_descriptor, error, error_length, MSG_NOSIGNAL) == -1)
+        {
+            perror("send");
+            goto early_return;
+        }
+
+        reply_bytes = error_length;
+        goto reply_sent;
     }
 
-    memset(connection_info->message_buffer, 0, sizeof(connection_info->message_buffer));
     while (fgets(connection_info->message_buffer, sizeof(connection_info->message_buffer), output_file) != NULL)
     {
-        if (sendto(connection_info->client_descriptor, connection_info->message_buffer, strlen(connection_info->message_buffer), MSG_NOSIGNAL, (struct sockaddr *)&connection_info->client_address, connection_info->client_length) == -1)
+        size_t line_length = strlen(connection_info->message_buffer);
+
+        if (sendto(connection_info->client_descriptor, connection_info->message_buffer, line_length, MSG_NOSIGNAL, (struct sockaddr *)&connection_info->client_address, connection_info->client_length) == -1)
         {
             perror("sendto");
             goto early_return;
         }
+
+        reply_bytes += line_length;
     }
 
+reply_sent:
+    trace_probe(reply_end, connection_info->client_descriptor, reply_bytes);
+
 early_return:
     fclose(output_file);
 fopen_failed:
-    if (pthread_mutex_unlock(connection_info->output_file_mutex))
+    if (profiled_mutex_unlock(connection_info->output_file_mutex))
     {
         perror("pthread_mutex_unlock");
     }
+    trace_probe(mutex_released, connection_info->output_file_mutex, connection_info->client_descriptor);
     syslog(LOG_NOTICE, "Closed connection from %s", inet_ntoa(connection_info->client_address.sin_addr));
 output_file_mutex_lock_failed:
     atomic_store(&connection_info->thread_complete, true);
+    trace_probe(close, connection_info->client_descriptor);
     shutdown(connection_info->client_descriptor, SHUT_RDWR);
     close(connection_info->client_descriptor);
 
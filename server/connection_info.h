@@ -7,11 +7,20 @@
 #include <stdio.h>
 #include <sys/queue.h>
 
+#ifndef USE_AESD_CHAR_DEVICE
 #define USE_AESD_CHAR_DEVICE 1
+#endif
+
+#if USE_AESD_CHAR_DEVICE
+#define DEFAULT_OUTPUT_FILE_PATH "/dev/aesdchar"
+#else
+#define DEFAULT_OUTPUT_FILE_PATH "/var/tmp/aesdsocketdata"
+#endif
 
 typedef struct ConnectionInfo
 {
     pthread_mutex_t *output_file_mutex;
+    const char *output_file_path;
 
     int client_descriptor;
     struct sockaddr_in client_address;
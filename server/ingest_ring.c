@@ -0,0 +1,357 @@
+#define _GNU_SOURCE // memfd_create()
+
+#include "ingest_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define INGEST_RING_MAGIC 0x41455344
+#define INGEST_RING_VERSION 1
+
+#define RECORD_HEADER_SIZE 8
+#define RECORD_COMMITTED 1u
+#define RECORD_PADDING 2u
+#define RECORD_LENGTH_SHIFT 2
+
+static size_t record_size(size_t length)
+{
+    return RECORD_HEADER_SIZE + ((length + 7) & ~(size_t)7);
+}
+
+static _Atomic uint32_t *record_header(IngestRingShared *shared, uint64_t position)
+{
+    return (_Atomic uint32_t *)&shared->data[position & (shared->capacity - 1)];
+}
+
+static int ingest_ring_map(IngestRing *ring, int memory_descriptor, int wakeup_descriptor, size_t mapped_length)
+{
+    ring->shared = mmap(NULL, mapped_length, PROT_READ | PROT_WRITE, MAP_SHARED, memory_descriptor, 0);
+    if (ring->shared == MAP_FAILED)
+    {
+        ring->shared = NULL;
+        return -1;
+    }
+
+    ring->mapped_length = mapped_length;
+    ring->memory_descriptor = memory_descriptor;
+    ring->wakeup_descriptor = wakeup_descriptor;
+    ring->reset_count = 0;
+
+    return 0;
+}
+
+int ingest_ring_create(IngestRing *ring, size_t capacity)
+{
+    size_t rounded = 4096;
+    int memory_descriptor;
+    int wakeup_descriptor;
+
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+
+    memory_descriptor = memfd_create("aesdsocket-ingest", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memory_descriptor == -1)
+    {
+        return -1;
+    }
+
+    // Sealed so a producer cannot shrink it under the server's mapping
+    if (ftruncate(memory_descriptor, sizeof(IngestRingShared) + rounded) == -1 ||
+        fcntl(memory_descriptor, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+    {
+        goto memory_setup_failed;
+    }
+
+    wakeup_descriptor = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_descriptor == -1)
+    {
+        goto memory_setup_failed;
+    }
+
+    if (ingest_ring_map(ring, memory_descriptor, wakeup_descriptor, sizeof(IngestRingShared) + rounded) == -1)
+    {
+        goto map_failed;
+    }
+
+    // The memfd starts zeroed, so every record header already reads as uncommitted
+    ring->shared->magic = INGEST_RING_MAGIC;
+    ring->shared->version = INGEST_RING_VERSION;
+    ring->shared->capacity = rounded;
+    atomic_init(&ring->shared->reserve_position, 0);
+    atomic_init(&ring->shared->consume_position, 0);
+    atomic_init(&ring->shared->consumer_sleeping, 0);
+
+    return 0;
+
+map_failed:
+    close(wakeup_descriptor);
+memory_setup_failed:
+    close(memory_descriptor);
+    return -1;
+}
+
+int ingest_ring_send(const IngestRing *ring, int socket_descriptor)
+{
+    int descriptors[2] = {ring->memory_descriptor, ring->wakeup_descriptor};
+    char control[CMSG_SPACE(sizeof(descriptors))] = {0};
+    char version = INGEST_RING_VERSION;
+    struct iovec payload = {.iov_base = &version, .iov_len = 1};
+    struct msghdr message = {
+        .msg_iov = &payload,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(descriptors));
+    memcpy(CMSG_DATA(header), descriptors, sizeof(descriptors));
+
+    return (sendmsg(socket_descriptor, &message, MSG_NOSIGNAL) == 1) ? 0 : -1;
+}
+
+int ingest_ring_connect(IngestRing *ring, const char *socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    int descriptors[2] = {-1, -1};
+    char control[CMSG_SPACE(sizeof(descriptors))];
+    char version = 0;
+    struct iovec payload = {.iov_base = &version, .iov_len = 1};
+    struct msghdr message = {
+        .msg_iov = &payload,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *header;
+    struct stat status;
+    int socket_descriptor;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(address.sun_path, socket_path);
+    socket_descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_descriptor == -1)
+    {
+        return -1;
+    }
+
+    if (connect(socket_descriptor, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        recvmsg(socket_descriptor, &message, MSG_CMSG_CLOEXEC) != 1)
+    {
+        goto receive_failed;
+    }
+
+    header = CMSG_FIRSTHDR(&message);
+    if (header == NULL || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(sizeof(descriptors)))
+    {
+        errno = EPROTO;
+        goto receive_failed;
+    }
+
+    memcpy(descriptors, CMSG_DATA(header), sizeof(descriptors));
+    if (fstat(descriptors[0], &status) == -1)
+    {
+        goto map_failed;
+    }
+
+    if (version != INGEST_RING_VERSION || (size_t)status.st_size <= sizeof(IngestRingShared))
+    {
+        errno = EPROTO;
+        goto map_failed;
+    }
+
+    if (ingest_ring_map(ring, descriptors[0], descriptors[1], status.st_size) == -1)
+    {
+        goto map_failed;
+    }
+
+    if (ring->shared->magic != INGEST_RING_MAGIC || sizeof(IngestRingShared) + ring->shared->capacity != (size_t)status.st_size)
+    {
+        munmap(ring->shared, ring->mapped_length);
+        errno = EPROTO;
+        goto map_failed;
+    }
+
+    close(socket_descriptor);
+
+    return 0;
+
+map_failed:
+    close(descriptors[0]);
+    close(descriptors[1]);
+receive_failed:
+    close(socket_descriptor);
+    return -1;
+}
+
+int ingest_ring_append(IngestRing *ring, const void *packet, size_t length)
+{
+    IngestRingShared *shared = ring->shared;
+    const uint64_t capacity = shared->capacity;
+    const size_t size = record_size(length);
+    uint64_t position = atomic_load_explicit(&shared->reserve_position, memory_order_relaxed);
+    uint64_t reserved;
+    size_t until_end;
+
+    if (size > capacity / 2 || length > (UINT32_MAX >> RECORD_LENGTH_SHIFT))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    do
+    {
+        // A record never wraps, so one that does not fit before the end also reserves the rest
+        until_end = capacity - (position & (capacity - 1));
+        reserved = (size <= until_end) ? size : until_end + size;
+        if (position + reserved - atomic_load_explicit(&shared->consume_position, memory_order_acquire) > capacity)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&shared->reserve_position, &position, position + reserved,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    if (reserved != size)
+    {
+        atomic_store_explicit(record_header(shared, position), (uint32_t)(until_end << RECORD_LENGTH_SHIFT) | RECORD_PADDING | RECORD_COMMITTED,
+                              memory_order_release);
+        position += until_end;
+    }
+
+    memcpy((unsigned char *)record_header(shared, position) + RECORD_HEADER_SIZE, packet, length);
+    atomic_store_explicit(record_header(shared, position), (uint32_t)(length << RECORD_LENGTH_SHIFT) | RECORD_COMMITTED, memory_order_release);
+
+    // Pairs with the fence in ingest_ring_prepare_sleep: either the consumer sees this record
+    // before sleeping or this sees it asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&shared->consumer_sleeping, memory_order_relaxed) != 0)
+    {
+        uint64_t one = 1;
+
+        if (write(ring->wakeup_descriptor, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+bool ingest_ring_pending(const IngestRing *ring)
+{
+    uint64_t position = atomic_load_explicit(&ring->shared->consume_position, memory_order_relaxed);
+
+    return (atomic_load_explicit(record_header(ring->shared, position), memory_order_acquire) & RECORD_COMMITTED) != 0;
+}
+
+/**
+ * Drops everything in the ring after a record header that producers could not have written
+ */
+static void ingest_ring_reset(IngestRing *ring)
+{
+    IngestRingShared *shared = ring->shared;
+
+    // Producers still copying into space reserved before the reset commit into cleared space
+    // behind the consumer, which it overwrites or clears before reaching it again
+    memset(shared->data, 0, shared->capacity);
+    atomic_store_explicit(&shared->consume_position, atomic_load_explicit(&shared->reserve_position, memory_order_acquire),
+                          memory_order_release);
+    ++ring->reset_count;
+}
+
+size_t ingest_ring_drain(IngestRing *ring, IngestPacketHandler handler, void *context)
+{
+    IngestRingShared *shared = ring->shared;
+    const uint64_t capacity = shared->capacity;
+    uint64_t position = atomic_load_explicit(&shared->consume_position, memory_order_relaxed);
+    size_t drained = 0;
+    bool stop = false;
+
+    while (!stop)
+    {
+        _Atomic uint32_t *header = record_header(shared, position);
+        uint32_t value = atomic_load_explicit(header, memory_order_acquire);
+        size_t length = value >> RECORD_LENGTH_SHIFT;
+        size_t offset = position & (capacity - 1);
+        size_t size;
+
+        if ((value & RECORD_COMMITTED) == 0)
+        {
+            break;
+        }
+
+        // The header lives in memory any producer can write, so a length that would run past
+        // the end of the ring or stall the consumer is not trusted
+        size = (value & RECORD_PADDING) ? length : record_size(length);
+        if (size == 0 || (size & 7) != 0 || offset + size > capacity || (!(value & RECORD_PADDING) && length > capacity / 2))
+        {
+            ingest_ring_reset(ring);
+            break;
+        }
+
+        if (!(value & RECORD_PADDING))
+        {
+            stop = handler((const char *)header + RECORD_HEADER_SIZE, length, context) != 0;
+            ++drained;
+        }
+
+        // Any 8 byte boundary of the space may hold a later record's header
+        memset((void *)header, 0, size);
+        position += size;
+        atomic_store_explicit(&shared->consume_position, position, memory_order_release);
+    }
+
+    return drained;
+}
+
+bool ingest_ring_prepare_sleep(IngestRing *ring)
+{
+    atomic_store_explicit(&ring->shared->consumer_sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (ingest_ring_pending(ring))
+    {
+        atomic_store_explicit(&ring->shared->consumer_sleeping, 0, memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+void ingest_ring_wake(IngestRing *ring)
+{
+    uint64_t count;
+
+    atomic_store_explicit(&ring->shared->consumer_sleeping, 0, memory_order_relaxed);
+    while (read(ring->wakeup_descriptor, &count, sizeof(count)) == sizeof(count))
+    {
+    }
+}
+
+void ingest_ring_close(IngestRing *ring)
+{
+    if (ring->shared != NULL)
+    {
+        munmap(ring->shared, ring->mapped_length);
+        ring->shared = NULL;
+    }
+
+    close(ring->memory_descriptor);
+    close(ring->wakeup_descriptor);
+}
@@ -0,0 +1,111 @@
+/*
+ * ingest_ring.h
+ *
+ *  @brief Shared memory ring through which local producers append packets to aesdsocket
+ *
+ *  aesdsocket started with -I maps a memfd holding the ring and hands it, with an eventfd, to
+ *  any process that connects to the socket given, INGEST_SOCKET_PATH by convention.  Producers
+ *  reserve space with a compare and swap on the shared reserve position, copy the packet in and
+ *  publish it by storing its record header, so an append costs no system call unless the server
+ *  is asleep and has to be woken through the eventfd.  The server drains committed records in
+ *  order and appends each to the same storage as a TCP packet.
+ *
+ *  Records are 8 byte aligned: a 4 byte header holding the payload length and flags, then the
+ *  payload.  A record that would not fit before the end of the ring is preceded by a padding
+ *  record covering the rest of it.  A header of 0 marks space reserved but not yet committed,
+ *  so the consumer clears what it has drained before handing the space back.  A producer that
+ *  dies between reserving and committing stalls the ring, which is acceptable for the trusted
+ *  local producers it is meant for.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define INGEST_SOCKET_PATH "/var/tmp/aesdsocket-ingest"
+#define INGEST_RING_CAPACITY (1 << 20)
+
+typedef struct IngestRingShared
+{
+    uint32_t magic;
+    uint32_t version;
+    // Bytes of data, a power of two
+    uint64_t capacity;
+
+    // Producers and the consumer each get their own cache line
+    _Alignas(64) _Atomic uint64_t reserve_position;
+    _Alignas(64) _Atomic uint64_t consume_position;
+    _Atomic uint32_t consumer_sleeping;
+
+    _Alignas(64) unsigned char data[];
+} IngestRingShared;
+
+typedef struct IngestRing
+{
+    IngestRingShared *shared;
+    size_t mapped_length;
+    int memory_descriptor;
+    int wakeup_descriptor;
+    // Times the consumer dropped the ring's contents over a corrupt record header
+    uint64_t reset_count;
+} IngestRing;
+
+/**
+ * Called for every drained packet
+ * @return 0 to continue draining, anything else to stop after this packet
+ */
+typedef int (*IngestPacketHandler)(const char *packet, size_t length, void *context);
+
+/**
+ * Creates a ring of @param capacity bytes, rounded up to a power of two, backed by a new memfd
+ * @return 0 on success, -1 with errno set on failure
+ */
+extern int ingest_ring_create(IngestRing *ring, size_t capacity);
+
+/**
+ * Connects to the server listening on @param socket_path and maps the ring it hands over
+ * @return 0 on success, -1 with errno set on failure
+ */
+extern int ingest_ring_connect(IngestRing *ring, const char *socket_path);
+
+/**
+ * Passes the ring's memfd and eventfd to the producer connected on @param socket_descriptor
+ * @return 0 on success, -1 with errno set on failure
+ */
+extern int ingest_ring_send(const IngestRing *ring, int socket_descriptor);
+
+/**
+ * Appends @param length bytes as one packet, waking the consumer if it is asleep
+ * @return 0 on success, -1 with errno EAGAIN if the ring is full or EMSGSIZE if the packet can
+ * never fit
+ */
+extern int ingest_ring_append(IngestRing *ring, const void *packet, size_t length);
+
+/**
+ * @return whether a committed packet is waiting to be drained
+ */
+extern bool ingest_ring_pending(const IngestRing *ring);
+
+/**
+ * Hands every committed packet to @param handler, oldest first.  A record header whose length
+ * does not fit the ring drops every record still in it and counts in reset_count.
+ * @return the number of packets drained
+ */
+extern size_t ingest_ring_drain(IngestRing *ring, IngestPacketHandler handler, void *context);
+
+/**
+ * Announces that the consumer is about to wait on the eventfd
+ * @return false if a packet was committed meanwhile, in which case the consumer should drain
+ * instead of waiting
+ */
+extern bool ingest_ring_prepare_sleep(IngestRing *ring);
+
+/**
+ * Ends a wait started with ingest_ring_prepare_sleep and clears the eventfd
+ */
+extern void ingest_ring_wake(IngestRing *ring);
+
+extern void ingest_ring_close(IngestRing *ring);
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE // accept4()
+
+#include "ingest_server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "../common/lock_profiler.h"
+#include "replication.h"
+#include "trace_probes.h"
+
+// Identifies the ring instead of a client descriptor in the trace probes
+#define INGEST_TRACE_DESCRIPTOR -2
+
+static int append_packet(const char *packet, size_t length, void *context)
+{
+    FILE *output_file = (FILE *)context;
+
+    // Flushed one by one so the driver commits each packet as its own entry, as for TCP
+    if (fwrite(packet, 1, length, output_file) != length || fflush(output_file) != 0)
+    {
+        fprintf(stderr, "failed to write to file: %.*s", (int)length, packet);
+        return 0;
+    }
+
+    replication_publish(packet, length);
+    trace_probe(append, INGEST_TRACE_DESCRIPTOR, length);
+
+    return 0;
+}
+
+static void drain_to_storage(IngestServer *ingest_server)
+{
+    FILE *output_file;
+    uint64_t reset_count;
+    size_t drained;
+
+    trace_probe(mutex_wait, ingest_server->output_file_mutex, INGEST_TRACE_DESCRIPTOR);
+    if (profiled_mutex_lock(ingest_server->output_file_mutex) != 0)
+    {
+        fprintf(stderr, "Failed to lock output file mutex: %s, %d", __FILE__, __LINE__);
+        return;
+    }
+
+    trace_probe(mutex_acquired, ingest_server->output_file_mutex, INGEST_TRACE_DESCRIPTOR);
+
+    output_file = fopen(ingest_server->output_file_path, "a");
+    if (output_file == NULL)
+    {
+        perror("fopen");
+        goto fopen_failed;
+    }
+
+    reset_count = ingest_server->ring.reset_count;
+    drained = ingest_ring_drain(&ingest_server->ring, append_packet, output_file);
+    trace_probe(ingest_drain, drained);
+    if (ingest_server->ring.reset_count != reset_count)
+    {
+        syslog(LOG_WARNING, "Dropped the ingest ring contents after a corrupt record header");
+    }
+
+    fclose(output_file);
+
+fopen_failed:
+    if (profiled_mutex_unlock(ingest_server->output_file_mutex) != 0)
+    {
+        perror("pthread_mutex_unlock");
+    }
+
+    trace_probe(mutex_released, ingest_server->output_file_mutex, INGEST_TRACE_DESCRIPTOR);
+}
+
+int ingest_server_init(IngestServer *ingest_server, pthread_mutex_t *output_file_mutex, const char *output_file_path,
+                       const char *socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    ingest_server->output_file_mutex = output_file_mutex;
+    ingest_server->output_file_path = output_file_path;
+    ingest_server->socket_path = socket_path;
+    atomic_store(&ingest_server->should_close, false);
+
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Ingest socket path too long: %s\n", socket_path);
+        goto ring_create_failed;
+    }
+
+    if (ingest_ring_create(&ingest_server->ring, INGEST_RING_CAPACITY) == -1)
+    {
+        perror("ingest_ring_create");
+        goto ring_create_failed;
+    }
+
+    ingest_server->listen_descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (ingest_server->listen_descriptor == -1)
+    {
+        perror("socket");
+        goto socket_failed;
+    }
+
+    // A socket left behind by a previous run would make bind fail
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(ingest_server->listen_descriptor, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+        perror("bind");
+        goto bind_failed;
+    }
+
+    if (listen(ingest_server->listen_descriptor, 16) == -1)
+    {
+        perror("listen");
+        goto listen_failed;
+    }
+
+    return 0;
+
+listen_failed:
+    unlink(ingest_server->socket_path);
+bind_failed:
+    close(ingest_server->listen_descriptor);
+socket_failed:
+    ingest_ring_close(&ingest_server->ring);
+ring_create_failed:
+    return -1;
+}
+
+void ingest_server_request_close(IngestServer *ingest_server)
+{
+    uint64_t one = 1;
+
+    atomic_store(&ingest_server->should_close, true);
+    if (write(ingest_server->ring.wakeup_descriptor, &one, sizeof(one)) == -1)
+    {
+        perror("write");
+    }
+}
+
+void ingest_server_cleanup(IngestServer *ingest_server)
+{
+    close(ingest_server->listen_descriptor);
+    unlink(ingest_server->socket_path);
+    ingest_ring_close(&ingest_server->ring);
+}
+
+void *ingest_server_thread_function(void *thread_arguments)
+{
+    IngestServer *ingest_server = (IngestServer *)thread_arguments;
+
+    while (!atomic_load(&ingest_server->should_close))
+    {
+        struct pollfd descriptors[2] = {
+            {.fd = ingest_server->listen_descriptor, .events = POLLIN},
+            {.fd = ingest_server->ring.wakeup_descriptor, .events = POLLIN},
+        };
+
+        if (ingest_ring_pending(&ingest_server->ring))
+        {
+            drain_to_storage(ingest_server);
+        }
+
+        if (!ingest_ring_prepare_sleep(&ingest_server->ring))
+        {
+            continue;
+        }
+
+        if (poll(descriptors, 2, -1) == -1 && errno != EINTR)
+        {
+            perror("poll");
+        }
+
+        ingest_ring_wake(&ingest_server->ring);
+
+        if (descriptors[0].revents & POLLIN)
+        {
+            int producer_descriptor = accept4(ingest_server->listen_descriptor, NULL, NULL, SOCK_CLOEXEC);
+
+            if (producer_descriptor != -1)
+            {
+                if (ingest_ring_send(&ingest_server->ring, producer_descriptor) == -1)
+                {
+                    perror("ingest_ring_send");
+                }
+
+                close(producer_descriptor);
+            }
+        }
+    }
+
+    // Packets committed before the close request are still stored
+    if (ingest_ring_pending(&ingest_server->ring))
+    {
+        drain_to_storage(ingest_server);
+    }
+
+    return NULL;
+}
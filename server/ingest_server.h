@@ -0,0 +1,42 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "ingest_ring.h"
+
+typedef struct IngestServer
+{
+    pthread_mutex_t *output_file_mutex;
+    const char *output_file_path;
+    const char *socket_path;
+
+    IngestRing ring;
+    int listen_descriptor;
+
+    atomic_bool should_close;
+} IngestServer;
+
+typedef struct IngestServerThread
+{
+    IngestServer thread_arguments;
+    pthread_t thread;
+} IngestServerThread;
+
+/**
+ * Creates the ring and listens for producers on @param socket_path, replacing any socket left
+ * there by a previous run
+ * @return 0 on success, -1 on failure
+ */
+int ingest_server_init(IngestServer *ingest_server, pthread_mutex_t *output_file_mutex, const char *output_file_path,
+                       const char *socket_path);
+
+/**
+ * Wakes the thread and has it return once it has drained the ring
+ */
+void ingest_server_request_close(IngestServer *ingest_server);
+
+void ingest_server_cleanup(IngestServer *ingest_server);
+
+void *ingest_server_thread_function(void *thread_arguments);
@@ -0,0 +1,939 @@
+#include "replication.h"
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../aesd-char-driver/aesd-newline-scan.h"
+#include "../common/lock_profiler.h"
+#include "trace_probes.h"
+
+#define REPLICATION_MAX_FOLLOWERS 16
+#define REPLICATION_CHUNK_SIZE 65536
+#define REPLICATION_HEARTBEAT_SECONDS 1
+// A peer silent for this long is treated as gone, which also bounds how long stopping takes
+#define REPLICATION_TIMEOUT_SECONDS 3
+#define REPLICATION_RECONNECT_SECONDS 1
+
+typedef enum ReplicationRole
+{
+    ROLE_STANDALONE,
+    ROLE_LEADER,
+    ROLE_FOLLOWER,
+} ReplicationRole;
+
+typedef enum ReplicationMessageType
+{
+    MESSAGE_HELLO = 1,
+    MESSAGE_APPEND,
+    MESSAGE_SNAPSHOT,
+    MESSAGE_HEARTBEAT,
+    MESSAGE_ACKNOWLEDGE,
+} ReplicationMessageType;
+
+/**
+ * offset is where the data starts for an append, where the storage ends after a snapshot, and
+ * the sender's applied or published offset otherwise.  timestamp_ns is the leader's
+ * CLOCK_REALTIME when it stored the newest byte the message covers.
+ */
+typedef struct ReplicationMessage
+{
+    uint32_t type;
+    uint32_t length;
+    uint64_t epoch;
+    uint64_t offset;
+    uint64_t leader_offset;
+    uint64_t timestamp_ns;
+} ReplicationMessage;
+
+typedef struct ReplicationFollower
+{
+    int descriptor;
+    pthread_t thread;
+    struct sockaddr_in address;
+    _Atomic uint64_t acknowledged_offset;
+
+    atomic_bool in_use;
+    atomic_bool thread_complete;
+} ReplicationFollower;
+
+static struct
+{
+    ReplicationRole role;
+    pthread_mutex_t *output_file_mutex;
+    const char *output_file_path;
+    atomic_bool should_close;
+
+    // Leader, the backlog holds the bytes up to published_offset, wrapping
+    uint64_t epoch;
+    int listen_descriptor;
+    pthread_t accept_thread;
+    pthread_mutex_t backlog_mutex;
+    pthread_cond_t published;
+    char *backlog;
+    uint64_t published_offset;
+    uint64_t published_ns;
+    ReplicationFollower followers[REPLICATION_MAX_FOLLOWERS];
+
+    // Follower, applied_offset only changes with the output file mutex held, so it always
+    // counts up to the end of the storage
+    char leader_host[256];
+    char leader_port[8];
+    pthread_t follower_thread;
+    atomic_bool connected;
+    _Atomic uint64_t applied_epoch;
+    _Atomic uint64_t applied_offset;
+    _Atomic uint64_t leader_offset;
+    _Atomic uint64_t lag_ns;
+} replication = {
+    .role = ROLE_STANDALONE,
+    .listen_descriptor = -1,
+    .backlog_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .published = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int send_all(int descriptor, const void *data, size_t length)
+{
+    const char *position = data;
+
+    while (length > 0)
+    {
+        ssize_t sent = send(descriptor, position, length, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (sent <= 0)
+        {
+            return -1;
+        }
+
+        position += sent;
+        length -= sent;
+    }
+
+    return 0;
+}
+
+static int receive_all(int descriptor, void *data, size_t length)
+{
+    char *position = data;
+
+    while (length > 0)
+    {
+        ssize_t received = recv(descriptor, position, length, 0);
+        if (received == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (received <= 0)
+        {
+            return -1;
+        }
+
+        position += received;
+        length -= received;
+    }
+
+    return 0;
+}
+
+static int send_message(int descriptor, const ReplicationMessage *message, const char *data)
+{
+    ReplicationMessage encoded = {
+        .type = htonl(message->type),
+        .length = htonl(message->length),
+        .epoch = htobe64(message->epoch),
+        .offset = htobe64(message->offset),
+        .leader_offset = htobe64(message->leader_offset),
+        .timestamp_ns = htobe64(message->timestamp_ns),
+    };
+
+    if (send_all(descriptor, &encoded, sizeof(encoded)) != 0)
+    {
+        return -1;
+    }
+
+    return (message->length > 0) ? send_all(descriptor, data, message->length) : 0;
+}
+
+/**
+ * Reads a message header, the caller reads the length bytes of data that follow it
+ */
+static int receive_message(int descriptor, ReplicationMessage *message)
+{
+    ReplicationMessage encoded;
+
+    if (receive_all(descriptor, &encoded, sizeof(encoded)) != 0)
+    {
+        return -1;
+    }
+
+    message->type = ntohl(encoded.type);
+    message->length = ntohl(encoded.length);
+    message->epoch = be64toh(encoded.epoch);
+    message->offset = be64toh(encoded.offset);
+    message->leader_offset = be64toh(encoded.leader_offset);
+    message->timestamp_ns = be64toh(encoded.timestamp_ns);
+
+    return 0;
+}
+
+static void set_timeouts(int descriptor)
+{
+    struct timeval timeout = {.tv_sec = REPLICATION_TIMEOUT_SECONDS};
+
+    setsockopt(descriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(descriptor, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/**
+ * Reads the whole storage into a buffer the caller frees.  Storage nothing was written to yet
+ * reads as empty.
+ * @return the buffer, or NULL on failure
+ */
+static char *read_storage(size_t *length)
+{
+    FILE *output_file = fopen(replication.output_file_path, "r");
+    size_t capacity = 65536;
+    char *data = malloc(capacity);
+    size_t read_bytes;
+
+    *length = 0;
+    if (data == NULL || (output_file == NULL && errno != ENOENT))
+    {
+        goto read_failed;
+    }
+
+    if (output_file == NULL)
+    {
+        return data;
+    }
+
+    while ((read_bytes = fread(data + *length, 1, capacity - *length, output_file)) > 0)
+    {
+        *length += read_bytes;
+        if (*length == capacity)
+        {
+            char *grown = realloc(data, capacity * 2);
+            if (grown == NULL)
+            {
+                goto read_failed;
+            }
+
+            data = grown;
+            capacity *= 2;
+        }
+    }
+
+    if (ferror(output_file))
+    {
+        goto read_failed;
+    }
+
+    fclose(output_file);
+
+    return data;
+
+read_failed:
+    if (output_file != NULL)
+    {
+        fclose(output_file);
+    }
+    free(data);
+    return NULL;
+}
+
+/**
+ * Sends the whole storage, read under the output file mutex so it matches the published offset
+ * @param position is set to the offset the follower continues from
+ */
+static int send_snapshot(ReplicationFollower *follower, uint64_t *position)
+{
+    ReplicationMessage message = {.type = MESSAGE_SNAPSHOT, .epoch = replication.epoch};
+    size_t length;
+    char *data;
+    int result;
+
+    if (profiled_mutex_lock(replication.output_file_mutex) != 0)
+    {
+        return -1;
+    }
+
+    data = read_storage(&length);
+    pthread_mutex_lock(&replication.backlog_mutex);
+    message.offset = replication.published_offset;
+    message.timestamp_ns = replication.published_ns;
+    pthread_mutex_unlock(&replication.backlog_mutex);
+    profiled_mutex_unlock(replication.output_file_mutex);
+
+    if (data == NULL || length > UINT32_MAX || length > message.offset)
+    {
+        fprintf(stderr, "Could not snapshot %s for a follower\n", replication.output_file_path);
+        free(data);
+        return -1;
+    }
+
+    message.length = length;
+    message.leader_offset = message.offset;
+    result = send_message(follower->descriptor, &message, data);
+    free(data);
+    *position = message.offset;
+
+    syslog(LOG_NOTICE, "Sent a %zu byte snapshot to follower %s", length, inet_ntoa(follower->address.sin_addr));
+
+    return result;
+}
+
+/**
+ * Records every acknowledgement already received without waiting for more
+ * @return 0, or -1 if the follower disconnected
+ */
+static int receive_acknowledgements(ReplicationFollower *follower)
+{
+    ReplicationMessage message;
+    ssize_t available;
+
+    while ((available = recv(follower->descriptor, &message, sizeof(message), MSG_PEEK | MSG_DONTWAIT)) == sizeof(message))
+    {
+        if (receive_message(follower->descriptor, &message) != 0 || message.type != MESSAGE_ACKNOWLEDGE)
+        {
+            return -1;
+        }
+
+        atomic_store(&follower->acknowledged_offset, message.offset);
+    }
+
+    return (available == 0 || (available == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) ? -1 : 0;
+}
+
+static void *follower_sender_thread_function(void *thread_arguments)
+{
+    ReplicationFollower *follower = (ReplicationFollower *)thread_arguments;
+    char *chunk = malloc(REPLICATION_CHUNK_SIZE);
+    ReplicationMessage hello;
+    uint64_t position;
+    bool needs_snapshot;
+
+    if (chunk == NULL || receive_message(follower->descriptor, &hello) != 0 || hello.type != MESSAGE_HELLO)
+    {
+        goto done;
+    }
+
+    position = hello.offset;
+    pthread_mutex_lock(&replication.backlog_mutex);
+    needs_snapshot = hello.epoch != replication.epoch || position > replication.published_offset ||
+                     replication.published_offset - position > REPLICATION_BACKLOG_SIZE;
+    pthread_mutex_unlock(&replication.backlog_mutex);
+    atomic_store(&follower->acknowledged_offset, position);
+
+    syslog(LOG_NOTICE, "Follower %s connected at offset %llu%s", inet_ntoa(follower->address.sin_addr), (unsigned long long)position,
+           needs_snapshot ? ", sending a snapshot" : "");
+
+    while (!atomic_load(&replication.should_close))
+    {
+        ReplicationMessage message = {.epoch = replication.epoch};
+
+        if (needs_snapshot)
+        {
+            if (send_snapshot(follower, &position) != 0)
+            {
+                break;
+            }
+
+            needs_snapshot = false;
+        }
+
+        pthread_mutex_lock(&replication.backlog_mutex);
+        if (replication.published_offset == position && !atomic_load(&replication.should_close))
+        {
+            struct timespec deadline;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += REPLICATION_HEARTBEAT_SECONDS;
+            pthread_cond_timedwait(&replication.published, &replication.backlog_mutex, &deadline);
+        }
+
+        // Fell behind by more than the backlog keeps
+        if (replication.published_offset - position > REPLICATION_BACKLOG_SIZE)
+        {
+            pthread_mutex_unlock(&replication.backlog_mutex);
+            needs_snapshot = true;
+            continue;
+        }
+
+        message.length = replication.published_offset - position;
+        if (message.length > REPLICATION_CHUNK_SIZE)
+        {
+            message.length = REPLICATION_CHUNK_SIZE;
+        }
+
+        if (message.length > 0)
+        {
+            size_t start = position % REPLICATION_BACKLOG_SIZE;
+            size_t first = (message.length < REPLICATION_BACKLOG_SIZE - start) ? message.length : REPLICATION_BACKLOG_SIZE - start;
+
+            memcpy(chunk, replication.backlog + start, first);
+            memcpy(chunk + first, replication.backlog, message.length - first);
+        }
+
+        message.type = (message.length > 0) ? MESSAGE_APPEND : MESSAGE_HEARTBEAT;
+        message.offset = (message.length > 0) ? position : replication.published_offset;
+        message.leader_offset = replication.published_offset;
+        message.timestamp_ns = replication.published_ns;
+        pthread_mutex_unlock(&replication.backlog_mutex);
+
+        if (send_message(follower->descriptor, &message, chunk) != 0 || receive_acknowledgements(follower) != 0)
+        {
+            break;
+        }
+
+        position += message.length;
+    }
+
+    syslog(LOG_NOTICE, "Follower %s disconnected at offset %llu", inet_ntoa(follower->address.sin_addr),
+           (unsigned long long)atomic_load(&follower->acknowledged_offset));
+
+done:
+    free(chunk);
+    atomic_store(&follower->thread_complete, true);
+
+    return NULL;
+}
+
+/**
+ * Joins @param follower's thread and frees its slot
+ */
+static void release_follower(ReplicationFollower *follower)
+{
+    pthread_join(follower->thread, NULL);
+    close(follower->descriptor);
+    atomic_store(&follower->in_use, false);
+}
+
+static void *accept_thread_function(void *thread_arguments)
+{
+    (void)thread_arguments;
+
+    while (!atomic_load(&replication.should_close))
+    {
+        struct sockaddr_in address;
+        socklen_t address_length = sizeof(address);
+        ReplicationFollower *follower = NULL;
+        int descriptor;
+
+        descriptor = accept(replication.listen_descriptor, (struct sockaddr *)&address, &address_length);
+        if (descriptor == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // replication_stop shuts the socket down
+            break;
+        }
+
+        for (size_t i = 0; i < REPLICATION_MAX_FOLLOWERS; ++i)
+        {
+            if (atomic_load(&replication.followers[i].in_use) && atomic_load(&replication.followers[i].thread_complete))
+            {
+                release_follower(&replication.followers[i]);
+            }
+
+            if (follower == NULL && !atomic_load(&replication.followers[i].in_use))
+            {
+                follower = &replication.followers[i];
+            }
+        }
+
+        if (follower == NULL)
+        {
+            syslog(LOG_WARNING, "Refusing follower %s, already serving %d", inet_ntoa(address.sin_addr), REPLICATION_MAX_FOLLOWERS);
+            close(descriptor);
+            continue;
+        }
+
+        set_timeouts(descriptor);
+        follower->descriptor = descriptor;
+        follower->address = address;
+        atomic_store(&follower->acknowledged_offset, 0);
+        atomic_store(&follower->thread_complete, false);
+        atomic_store(&follower->in_use, true);
+        if (pthread_create(&follower->thread, NULL, follower_sender_thread_function, (void *)follower) != 0)
+        {
+            perror("pthread_create");
+            close(descriptor);
+            atomic_store(&follower->in_use, false);
+        }
+    }
+
+    return NULL;
+}
+
+int replication_leader_start(unsigned short port, pthread_mutex_t *output_file_mutex, const char *output_file_path)
+{
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(port),
+    };
+    const int enable = 1;
+    size_t length;
+    char *data;
+
+    replication.output_file_mutex = output_file_mutex;
+    replication.output_file_path = output_file_path;
+    replication.epoch = realtime_ns() ^ ((uint64_t)getpid() << 32);
+
+    // Offsets continue from what the storage already holds, so they match positions in it.
+    // Counted by reading, as /dev/aesdchar reports a size of 0 whatever it holds.
+    data = read_storage(&length);
+    if (data == NULL)
+    {
+        fprintf(stderr, "Could not read %s to start replication\n", output_file_path);
+        goto storage_read_failed;
+    }
+
+    free(data);
+    replication.published_offset = length;
+    replication.published_ns = realtime_ns();
+
+    replication.backlog = malloc(REPLICATION_BACKLOG_SIZE);
+    if (replication.backlog == NULL)
+    {
+        perror("malloc");
+        goto backlog_malloc_failed;
+    }
+
+    replication.listen_descriptor = socket(AF_INET, SOCK_STREAM, 0);
+    if (replication.listen_descriptor == -1)
+    {
+        perror("socket");
+        goto socket_failed;
+    }
+
+    if (setsockopt(replication.listen_descriptor, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1 ||
+        bind(replication.listen_descriptor, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(replication.listen_descriptor, REPLICATION_MAX_FOLLOWERS) == -1)
+    {
+        perror("replication listen");
+        goto listen_failed;
+    }
+
+    replication.role = ROLE_LEADER;
+    if (pthread_create(&replication.accept_thread, NULL, accept_thread_function, NULL) != 0)
+    {
+        perror("pthread_create");
+        goto accept_thread_create_failed;
+    }
+
+    return 0;
+
+accept_thread_create_failed:
+    replication.role = ROLE_STANDALONE;
+listen_failed:
+    close(replication.listen_descriptor);
+    replication.listen_descriptor = -1;
+socket_failed:
+    free(replication.backlog);
+    replication.backlog = NULL;
+backlog_malloc_failed:
+storage_read_failed:
+    return -1;
+}
+
+static int connect_to_leader(void)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addresses;
+    int descriptor = -1;
+
+    if (getaddrinfo(replication.leader_host, replication.leader_port, &hints, &addresses) != 0)
+    {
+        return -1;
+    }
+
+    for (struct addrinfo *address = addresses; address != NULL && descriptor == -1; address = address->ai_next)
+    {
+        descriptor = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (descriptor != -1 && connect(descriptor, address->ai_addr, address->ai_addrlen) == -1)
+        {
+            close(descriptor);
+            descriptor = -1;
+        }
+    }
+
+    freeaddrinfo(addresses);
+    if (descriptor != -1)
+    {
+        set_timeouts(descriptor);
+    }
+
+    return descriptor;
+}
+
+/**
+ * Appends the data of @param message to the storage one packet at a time, as a TCP client's
+ * packets are, or replaces the storage with it for a snapshot, then advances applied_offset
+ * before the storage is unlocked
+ */
+static int apply_to_storage(const ReplicationMessage *message, const char *data)
+{
+    const bool snapshot = message->type == MESSAGE_SNAPSHOT;
+    const size_t length = message->length;
+    FILE *output_file;
+    size_t piece_length = 0;
+    int result = 0;
+
+    if (profiled_mutex_lock(replication.output_file_mutex) != 0)
+    {
+        return -1;
+    }
+
+    output_file = fopen(replication.output_file_path, snapshot ? "w" : "a");
+    if (output_file == NULL)
+    {
+        perror("fopen");
+        result = -1;
+        goto fopen_failed;
+    }
+
+    for (size_t start = 0; start < length && result == 0; start += piece_length)
+    {
+        piece_length = aesd_newline_find(data + start, length - start);
+        if (piece_length < length - start)
+        {
+            ++piece_length;
+        }
+
+        if (fwrite(data + start, 1, piece_length, output_file) != piece_length || fflush(output_file) != 0)
+        {
+            fprintf(stderr, "failed to write to file: %.*s", (int)piece_length, data + start);
+            result = -1;
+        }
+    }
+
+    fclose(output_file);
+    if (result == 0 && snapshot)
+    {
+        atomic_store(&replication.applied_epoch, message->epoch);
+    }
+
+    if (result == 0)
+    {
+        atomic_store(&replication.applied_offset, snapshot ? message->offset : message->offset + message->length);
+    }
+
+fopen_failed:
+    profiled_mutex_unlock(replication.output_file_mutex);
+
+    return result;
+}
+
+/**
+ * Applies every message from the leader on @param descriptor until it disconnects, falls
+ * silent or sends an append that does not continue the storage
+ */
+static void follow_leader(int descriptor)
+{
+    ReplicationMessage message;
+    char *data = NULL;
+    size_t capacity = 0;
+
+    while (!atomic_load(&replication.should_close) && receive_message(descriptor, &message) == 0)
+    {
+        ReplicationMessage acknowledgement = {.type = MESSAGE_ACKNOWLEDGE};
+
+        if (message.length > capacity)
+        {
+            char *grown = realloc(data, message.length);
+            if (grown == NULL)
+            {
+                break;
+            }
+
+            data = grown;
+            capacity = message.length;
+        }
+
+        if (message.length > 0 && receive_all(descriptor, data, message.length) != 0)
+        {
+            break;
+        }
+
+        if (message.type == MESSAGE_APPEND)
+        {
+            if (message.offset != atomic_load(&replication.applied_offset))
+            {
+                syslog(LOG_WARNING, "Leader sent offset %llu, expected %llu", (unsigned long long)message.offset,
+                       (unsigned long long)atomic_load(&replication.applied_offset));
+                break;
+            }
+
+            if (apply_to_storage(&message, data) != 0)
+            {
+                break;
+            }
+
+            trace_probe(replication_apply, message.offset, message.length);
+        }
+        else if (message.type == MESSAGE_SNAPSHOT)
+        {
+            if (apply_to_storage(&message, data) != 0)
+            {
+                break;
+            }
+
+            syslog(LOG_NOTICE, "Applied a %u byte snapshot up to offset %llu", message.length, (unsigned long long)message.offset);
+        }
+        else if (message.type != MESSAGE_HEARTBEAT)
+        {
+            break;
+        }
+
+        atomic_store(&replication.leader_offset, message.leader_offset);
+        atomic_store(&replication.lag_ns, (atomic_load(&replication.applied_offset) >= message.leader_offset && message.type == MESSAGE_HEARTBEAT)
+                                              ? 0
+                                              : realtime_ns() - message.timestamp_ns);
+
+        acknowledgement.epoch = atomic_load(&replication.applied_epoch);
+        acknowledgement.offset = atomic_load(&replication.applied_offset);
+        if (send_message(descriptor, &acknowledgement, NULL) != 0)
+        {
+            break;
+        }
+    }
+
+    free(data);
+}
+
+static void *follower_thread_function(void *thread_arguments)
+{
+    (void)thread_arguments;
+
+    while (!atomic_load(&replication.should_close))
+    {
+        ReplicationMessage hello = {.type = MESSAGE_HELLO};
+        int descriptor = connect_to_leader();
+
+        if (descriptor == -1)
+        {
+            sleep(REPLICATION_RECONNECT_SECONDS);
+            continue;
+        }
+
+        hello.epoch = atomic_load(&replication.applied_epoch);
+        hello.offset = atomic_load(&replication.applied_offset);
+        if (send_message(descriptor, &hello, NULL) == 0)
+        {
+            syslog(LOG_NOTICE, "Following %s:%s from offset %llu", replication.leader_host, replication.leader_port, (unsigned long long)hello.offset);
+            atomic_store(&replication.connected, true);
+            follow_leader(descriptor);
+            atomic_store(&replication.connected, false);
+        }
+
+        close(descriptor);
+        if (!atomic_load(&replication.should_close))
+        {
+            syslog(LOG_WARNING, "Lost the leader at offset %llu, reconnecting", (unsigned long long)atomic_load(&replication.applied_offset));
+            sleep(REPLICATION_RECONNECT_SECONDS);
+        }
+    }
+
+    return NULL;
+}
+
+int replication_follower_start(const char *leader, pthread_mutex_t *output_file_mutex, const char *output_file_path)
+{
+    const char *separator = strrchr(leader, ':');
+
+    if (separator == NULL || separator == leader || (size_t)(separator - leader) >= sizeof(replication.leader_host) ||
+        strlen(separator + 1) == 0 || strlen(separator + 1) >= sizeof(replication.leader_port))
+    {
+        fprintf(stderr, "Expected the leader as host:port, got %s\n", leader);
+        return -1;
+    }
+
+    memcpy(replication.leader_host, leader, separator - leader);
+    replication.leader_host[separator - leader] = '\0';
+    strcpy(replication.leader_port, separator + 1);
+    replication.output_file_mutex = output_file_mutex;
+    replication.output_file_path = output_file_path;
+
+    replication.role = ROLE_FOLLOWER;
+    if (pthread_create(&replication.follower_thread, NULL, follower_thread_function, NULL) != 0)
+    {
+        perror("pthread_create");
+        replication.role = ROLE_STANDALONE;
+        return -1;
+    }
+
+    return 0;
+}
+
+void replication_stop(void)
+{
+    atomic_store(&replication.should_close, true);
+
+    if (replication.role == ROLE_FOLLOWER)
+    {
+        pthread_join(replication.follower_thread, NULL);
+    }
+    else if (replication.role == ROLE_LEADER)
+    {
+        shutdown(replication.listen_descriptor, SHUT_RDWR);
+        pthread_join(replication.accept_thread, NULL);
+        close(replication.listen_descriptor);
+
+        pthread_mutex_lock(&replication.backlog_mutex);
+        pthread_cond_broadcast(&replication.published);
+        pthread_mutex_unlock(&replication.backlog_mutex);
+
+        for (size_t i = 0; i < REPLICATION_MAX_FOLLOWERS; ++i)
+        {
+            if (atomic_load(&replication.followers[i].in_use))
+            {
+                release_follower(&replication.followers[i]);
+            }
+        }
+
+        free(replication.backlog);
+        replication.backlog = NULL;
+    }
+
+    replication.role = ROLE_STANDALONE;
+}
+
+bool replication_is_follower(void)
+{
+    return replication.role == ROLE_FOLLOWER;
+}
+
+void replication_publish(const char *data, size_t length)
+{
+    uint64_t offset;
+    size_t skipped;
+    size_t start;
+    size_t first;
+
+    if (replication.role != ROLE_LEADER)
+    {
+        return;
+    }
+
+    // Only the end of an append larger than the backlog is kept
+    skipped = (length > REPLICATION_BACKLOG_SIZE) ? length - REPLICATION_BACKLOG_SIZE : 0;
+
+    pthread_mutex_lock(&replication.backlog_mutex);
+    offset = replication.published_offset;
+    start = (offset + skipped) % REPLICATION_BACKLOG_SIZE;
+    first = (length - skipped < REPLICATION_BACKLOG_SIZE - start) ? length - skipped : REPLICATION_BACKLOG_SIZE - start;
+    memcpy(replication.backlog + start, data + skipped, first);
+    memcpy(replication.backlog, data + skipped + first, length - skipped - first);
+    replication.published_offset += length;
+    replication.published_ns = realtime_ns();
+    pthread_cond_broadcast(&replication.published);
+    pthread_mutex_unlock(&replication.backlog_mutex);
+
+    trace_probe(replication_publish, offset, length);
+}
+
+long replication_storage_position(uint64_t offset, long storage_size)
+{
+    uint64_t end_offset = (uint64_t)storage_size;
+    uint64_t base_offset;
+
+    // Both only change with the output file mutex held, which the caller holds
+    if (replication.role == ROLE_LEADER)
+    {
+        end_offset = replication.published_offset;
+    }
+    else if (replication.role == ROLE_FOLLOWER)
+    {
+        end_offset = atomic_load(&replication.applied_offset);
+    }
+
+    // The storage holds the newest storage_size bytes, fewer than were ever stored once a
+    // snapshot replaced it or /dev/aesdchar evicted entries
+    base_offset = (end_offset > (uint64_t)storage_size) ? end_offset - storage_size : 0;
+    if (storage_size < 0 || offset < base_offset || offset > end_offset)
+    {
+        return -1;
+    }
+
+    return (long)(offset - base_offset);
+}
+
+size_t replication_format_status(char *buffer, size_t size)
+{
+    size_t length = 0;
+    int written;
+
+    if (replication.role == ROLE_LEADER)
+    {
+        uint64_t published_offset;
+
+        pthread_mutex_lock(&replication.backlog_mutex);
+        published_offset = replication.published_offset;
+        pthread_mutex_unlock(&replication.backlog_mutex);
+
+        written = snprintf(buffer, size, "role leader epoch %llu offset %llu\n", (unsigned long long)replication.epoch, (unsigned long long)published_offset);
+        length = (written < 0) ? 0 : (size_t)written;
+
+        for (size_t i = 0; i < REPLICATION_MAX_FOLLOWERS && length < size; ++i)
+        {
+            ReplicationFollower *follower = &replication.followers[i];
+            uint64_t acknowledged_offset = atomic_load(&follower->acknowledged_offset);
+
+            if (!atomic_load(&follower->in_use) || atomic_load(&follower->thread_complete))
+            {
+                continue;
+            }
+
+            written = snprintf(buffer + length, size - length, "follower %s:%u acknowledged %llu lag_bytes %llu\n", inet_ntoa(follower->address.sin_addr),
+                               ntohs(follower->address.sin_port), (unsigned long long)acknowledged_offset,
+                               (unsigned long long)((published_offset > acknowledged_offset) ? published_offset - acknowledged_offset : 0));
+            length += (written < 0) ? 0 : (size_t)written;
+        }
+    }
+    else if (replication.role == ROLE_FOLLOWER)
+    {
+        uint64_t applied_offset = atomic_load(&replication.applied_offset);
+        uint64_t leader_offset = atomic_load(&replication.leader_offset);
+
+        written = snprintf(buffer, size, "role follower leader %s:%s connected %s epoch %llu offset %llu leader_offset %llu lag_bytes %llu lag_us %llu\n",
+                           replication.leader_host, replication.leader_port, atomic_load(&replication.connected) ? "yes" : "no",
+                           (unsigned long long)atomic_load(&replication.applied_epoch), (unsigned long long)applied_offset, (unsigned long long)leader_offset,
+                           (unsigned long long)((leader_offset > applied_offset) ? leader_offset - applied_offset : 0),
+                           (unsigned long long)(atomic_load(&replication.lag_ns) / 1000));
+        length = (written < 0) ? 0 : (size_t)written;
+    }
+    else
+    {
+        written = snprintf(buffer, size, "role standalone\n");
+        length = (written < 0) ? 0 : (size_t)written;
+    }
+
+    return (length < size) ? length : size - 1;
+}
@@ -0,0 +1,71 @@
+/*
+ * replication.h
+ *
+ *  @brief Leader/follower replication of the aesdsocket storage
+ *
+ *  A leader numbers every byte it appends with a replication offset, starting from the size of
+ *  its storage at startup, and keeps the most recent REPLICATION_BACKLOG_SIZE bytes in memory.
+ *  Followers connect to its replication port and send the epoch and offset they have applied
+ *  up to.  A follower within the backlog of the same leader run is streamed the appends from
+ *  that offset on, so it resumes where it left off after a reconnect.  Any other follower is
+ *  first sent a snapshot of the whole storage.  While idle the leader sends heartbeats, and
+ *  followers acknowledge every message with the offset they have applied, so both sides can
+ *  report the replication lag in bytes, and followers also in time since the leader stored
+ *  the newest append they applied.
+ *
+ *  Followers are read only: their clients get the history reply, but packets are not stored.
+ *  A follower overwrites its storage with the snapshot, so it should use a file of its own.
+ *
+ *  Messages are a fixed size header in network byte order, followed by length bytes of data
+ *  for appends and snapshots.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define REPLICATION_BACKLOG_SIZE (4 << 20)
+#define REPLICATION_STATUS_COMMAND "AESDSOCKET_REPLICATION_STATUS\n"
+
+/**
+ * Starts accepting followers on @param port
+ * @return 0 on success, -1 on failure
+ */
+int replication_leader_start(unsigned short port, pthread_mutex_t *output_file_mutex, const char *output_file_path);
+
+/**
+ * Starts following the leader at @param leader, given as host:port, reconnecting whenever the
+ * connection drops
+ * @return 0 on success, -1 on failure
+ */
+int replication_follower_start(const char *leader, pthread_mutex_t *output_file_mutex, const char *output_file_path);
+
+/**
+ * Disconnects from the leader or from every follower and waits for the replication threads
+ */
+void replication_stop(void);
+
+bool replication_is_follower(void);
+
+/**
+ * Hands @param length bytes just appended to the storage to the followers.  Must be called
+ * with the output file mutex held, so offsets follow the order of the storage.
+ */
+void replication_publish(const char *data, size_t length);
+
+/**
+ * Must be called with the output file mutex held
+ * @param storage_size is the number of bytes the storage holds
+ * @return the position in the storage of the byte at replication @param offset, or -1 if the
+ * storage no longer holds it or it was not stored yet
+ */
+long replication_storage_position(uint64_t offset, long storage_size);
+
+/**
+ * Writes the role, offsets and lag of this instance to @param buffer, one line per connection
+ * @return the length written, truncated to @param size - 1
+ */
+size_t replication_format_status(char *buffer, size_t size);
@@ -3,6 +3,10 @@
 #include <time.h>
 #include <errno.h>
 
+#include "../common/lock_profiler.h"
+#include "replication.h"
+#include "trace_probes.h"
+
 void *timestamp_writer_thread_function(void *thread_arguments)
 {
     TimestampWriter *timestamp_writer = (TimestampWriter *)thread_arguments;
@@ -35,19 +39,24 @@ void *timestamp_writer_thread_function(void *thread_arguments)
             return NULL;
         }
 
-        if (pthread_mutex_lock(timestamp_writer->output_file_mutex) != 0)
+        trace_probe(mutex_wait, timestamp_writer->output_file_mutex, -1);
+        if (profiled_mutex_lock(timestamp_writer->output_file_mutex) != 0)
         {
             fprintf(stderr, "Failed to lock output file mutex: %s, %d", __FILE__, __LINE__);
             return NULL;
         }
 
-        output_file = fopen("/var/tmp/aesdsocketdata", "a+");
+        trace_probe(mutex_acquired, timestamp_writer->output_file_mutex, -1);
+
+        output_file = fopen(timestamp_writer->output_file_path, "a+");
         if (output_file == NULL)
         {
             return NULL;
         }
 
-        if (fprintf(output_file, "timestamp:%s\n", buffer) == -1)
+        char line[96];
+        int written = snprintf(line, sizeof(line), "timestamp:%s\n", buffer);
+        if (fwrite(line, 1, written, output_file) != (size_t)written)
         {
             fprintf(stderr, "writing time to file failed\n");
             fclose(output_file);
@@ -55,13 +64,17 @@ void *timestamp_writer_thread_function(void *thread_arguments)
         }
 
         fclose(output_file);
+        replication_publish(line, written);
+        trace_probe(append, -1, written);
 
-        if (pthread_mutex_unlock(timestamp_writer->output_file_mutex) != 0)
+        if (profiled_mutex_unlock(timestamp_writer->output_file_mutex) != 0)
         {
             perror("pthread_mutex_unlock");
             return NULL;
         }
 
+        trace_probe(mutex_released, timestamp_writer->output_file_mutex, -1);
+
         if (atomic_load(&timestamp_writer->should_close))
         {
             return NULL;
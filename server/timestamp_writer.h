@@ -9,6 +9,7 @@
 typedef struct TimestampWriter
 {
     pthread_mutex_t *output_file_mutex;
+    const char *output_file_path;
 
     atomic_bool should_close;
 } TimestampWriter;
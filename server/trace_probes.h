@@ -0,0 +1,48 @@
+/*
+ * trace_probes.h
+ *
+ *  @brief USDT probes marking the phases of a connection, for perf and bpftrace
+ *
+ *  Each trace_probe(name, ...) is a sys/sdt.h probe of the aesdsocket provider: a single nop in
+ *  the code plus a .note.stapsdt entry describing its arguments, so nothing runs unless a
+ *  tracer attaches to it.  They can be listed with bpftrace -l 'usdt:./aesdsocket:*'.  Builds
+ *  without sys/sdt.h (systemtap-sdt-dev), or with -DNO_TRACE_PROBES, leave them out entirely.
+ *
+ *  Probes and arguments, where the timestamp writer passes -1 as the client descriptor and
+ *  the ingest ring -2:
+ *      accept(client_descriptor, client_address)
+ *      recv(client_descriptor, bytes)
+ *      packet_complete(client_descriptor, bytes received)
+ *      mutex_wait, mutex_acquired, mutex_released(mutex, client_descriptor)
+ *      append(client_descriptor, bytes)
+ *      seek(client_descriptor, write_cmd, write_cmd_offset)
+ *      reply_begin(client_descriptor), reply_end(client_descriptor, bytes sent)
+ *      close(client_descriptor)
+ *      ingest_drain(packets drained from the ingest ring)
+ *      replication_publish, replication_apply(replication offset, bytes)
+ */
+
+#pragma once
+
+#if !defined(NO_TRACE_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef TRACE_PROBES_ENABLED
+
+#define trace_probe(name, ...) DTRACE_PROBE_SELECT(__VA_ARGS__, DTRACE_PROBE3, DTRACE_PROBE2, DTRACE_PROBE1, )(aesdsocket, name, __VA_ARGS__)
+#define DTRACE_PROBE_SELECT(_1, _2, _3, probe, ...) probe
+
+#else
+
+/**
+ * Never defined: it only appears in sizeof, which marks the arguments used without evaluating them
+ */
+extern void trace_probe_discard(int unused, ...);
+
+#define trace_probe(name, ...) ((void)sizeof(trace_probe_discard(0, __VA_ARGS__), 0))
+
+#endif
@@ -0,0 +1,186 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Edge cases of the binary search in aesd_circular_buffer_find_entry_offset_for_fpos() and of
+* aesd_circular_buffer_export_range(), on buffers filled with the writes below.  Each write is
+* "write<n>\n", 7 bytes for n below 10 and 8 bytes above, so offsets are easy to work out.
+*/
+#define WRITE_COUNT (AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3)
+static char writes[WRITE_COUNT][32];
+
+/**
+* Adds @param count writes to @param buffer, the oldest evicted once it is full
+* @return the number of bytes the buffer holds afterwards
+*/
+static size_t fill_buffer(AesdCircularBuffer *buffer, size_t count)
+{
+    AesdBufferEntry entry;
+    aesd_circular_buffer_init(buffer);
+    for (size_t i = 0; i < count; i++) {
+        snprintf(writes[i], sizeof(writes[i]), "write%zu\n", i);
+        entry.buffptr = writes[i];
+        entry.size = strlen(writes[i]);
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+    return aesd_circular_buffer_size(buffer);
+}
+
+/**
+* Concatenates the bytes described by @param vecs into @param out, which must be large enough
+*/
+static void join_vecs(const AesdBufferVec *vecs, size_t vec_count, char *out)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < vec_count; i++) {
+        memcpy(out + length, vecs[i].iov_base, vecs[i].iov_len);
+        length += vecs[i].iov_len;
+    }
+    out[length] = '\0';
+}
+
+void test_find_entry_offset_for_fpos_every_offset_of_wrapped_buffer()
+{
+    AesdCircularBuffer buffer;
+    size_t total = fill_buffer(&buffer, WRITE_COUNT);
+    size_t oldest = 3;
+    size_t expected_write = oldest;
+    size_t expected_byte = 0;
+
+    TEST_ASSERT_TRUE_MESSAGE(buffer.full, "Adding more writes than entries should fill the buffer");
+    for (size_t fpos = 0; fpos < total; fpos++) {
+        size_t entry_offset = 0;
+        AesdBufferEntry *entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, fpos, &entry_offset);
+        TEST_ASSERT_NOT_NULL_MESSAGE(entry, "Every offset before the end should be found");
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[expected_write], entry->buffptr, "Offset found in the wrong entry");
+        TEST_ASSERT_EQUAL_UINT_MESSAGE(expected_byte, entry_offset, "Wrong byte offset within the entry");
+        if (++expected_byte == strlen(writes[expected_write])) {
+            expected_byte = 0;
+            expected_write++;
+        }
+    }
+}
+
+void test_find_entry_offset_for_fpos_at_and_past_end()
+{
+    AesdCircularBuffer buffer;
+    size_t entry_offset = 0;
+    size_t total = fill_buffer(&buffer, WRITE_COUNT);
+
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, total, &entry_offset),
+                             "The offset just past the last byte should not be found");
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, total + 100, &entry_offset),
+                             "Offsets well past the end should not be found");
+
+    fill_buffer(&buffer, 0);
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &entry_offset),
+                             "Nothing should be found in an empty buffer");
+}
+
+void test_export_range_starting_inside_first_entry()
+{
+    AesdCircularBuffer buffer;
+    AesdBufferVec vecs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    char joined[sizeof(writes)];
+    size_t bytes = 0;
+    size_t vec_count;
+
+    fill_buffer(&buffer, 3);
+    vec_count = aesd_circular_buffer_export_range(&buffer, 2, 100, vecs, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(3, vec_count, "Expected one vector per entry touched");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[0] + 2, vecs[0].iov_base, "The first vector should start part way into its entry");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(5, vecs[0].iov_len, "The first vector should run to the end of its entry");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(19, bytes, "A range past the end should stop at the end of the buffer");
+    join_vecs(vecs, vec_count, joined);
+    TEST_ASSERT_EQUAL_STRING("ite0\nwrite1\nwrite2\n", joined);
+}
+
+void test_export_range_trims_last_entry()
+{
+    AesdCircularBuffer buffer;
+    AesdBufferVec vecs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    char joined[sizeof(writes)];
+    size_t bytes = 0;
+    size_t vec_count;
+
+    fill_buffer(&buffer, 3);
+    vec_count = aesd_circular_buffer_export_range(&buffer, 3, 8, vecs, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(2, vec_count, "Expected the range to end in the second entry");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(4, vecs[1].iov_len, "The last vector should be trimmed to the end of the range");
+    TEST_ASSERT_EQUAL_UINT(8, bytes);
+    join_vecs(vecs, vec_count, joined);
+    TEST_ASSERT_EQUAL_STRING("te0\nwrit", joined);
+
+    vec_count = aesd_circular_buffer_export_range(&buffer, 7, 7, vecs, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(1, vec_count, "A range covering exactly one entry should take one vector");
+    TEST_ASSERT_EQUAL_PTR(writes[1], vecs[0].iov_base);
+    TEST_ASSERT_EQUAL_UINT(7, bytes);
+}
+
+void test_export_range_across_wrapped_buffer()
+{
+    AesdCircularBuffer buffer;
+    AesdBufferVec vecs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    char joined[sizeof(writes)];
+    char expected[sizeof(writes)] = "";
+    size_t bytes = 0;
+    size_t total = fill_buffer(&buffer, WRITE_COUNT);
+    size_t vec_count;
+
+    for (size_t i = 3; i < WRITE_COUNT; i++) {
+        strcat(expected, writes[i]);
+    }
+
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(0, buffer.out_offs, "The oldest entry should no longer be in the first slot");
+    vec_count = aesd_circular_buffer_export_range(&buffer, 0, total, vecs, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, vec_count, "Expected every entry, oldest first");
+    TEST_ASSERT_EQUAL_UINT(total, bytes);
+    join_vecs(vecs, vec_count, joined);
+    TEST_ASSERT_EQUAL_STRING(expected, joined);
+}
+
+void test_export_range_at_and_past_end()
+{
+    AesdCircularBuffer buffer;
+    AesdBufferVec vecs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t bytes = 1;
+    size_t total = fill_buffer(&buffer, 3);
+
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(0, aesd_circular_buffer_export_range(&buffer, total, 10, vecs, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes),
+                                   "A range starting at the end should describe nothing");
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+
+    bytes = 1;
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(0, aesd_circular_buffer_export_range(&buffer, total + 100, 10, vecs, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes),
+                                   "A range starting past the end should describe nothing");
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+
+    bytes = 1;
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(0, aesd_circular_buffer_export_range(&buffer, 0, 0, vecs, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes),
+                                   "An empty range should describe nothing");
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+}
+
+void test_export_range_stops_when_vecs_run_out()
+{
+    AesdCircularBuffer buffer;
+    AesdBufferVec vecs[2];
+    char joined[sizeof(writes)];
+    size_t bytes = 0;
+    size_t total = fill_buffer(&buffer, WRITE_COUNT);
+    size_t vec_count;
+
+    vec_count = aesd_circular_buffer_export_range(&buffer, 1, total, vecs, 2, &bytes);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(2, vec_count, "Only the vectors available should be filled");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(vecs[0].iov_len + vecs[1].iov_len, bytes, "bytes_rtn should count only what was described");
+    join_vecs(vecs, vec_count, joined);
+    TEST_ASSERT_EQUAL_STRING("rite3\nwrite4\n", joined);
+
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(0, aesd_circular_buffer_export_range(&buffer, 0, total, vecs, 0, &bytes),
+                                   "No vectors should describe nothing");
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+}